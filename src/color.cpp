@@ -0,0 +1,243 @@
+  /*
+   * Copyright (C) 2020  Patrick Pedersen
+
+   * This program is free software: you can redistribute it and/or modify
+   * it under the terms of the GNU General Public License as published by
+   * the Free Software Foundation, either version 3 of the License, or
+   * (at your option) any later version.
+
+   * This program is distributed in the hope that it will be useful,
+   * but WITHOUT ANY WARRANTY; without even the implied warranty of
+   * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   * GNU General Public License for more details.
+
+   * You should have received a copy of the GNU General Public License
+   * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+   * 
+   * Author: Patrick Pedersen <ctx.xda@gmail.com>
+   * Description: Integer color math routines.
+   * 
+   */
+
+#include "color.h"
+
+/* scale8_buf
+ * ----------
+ * Parameters:
+ *      buf - Buffer of 8-bit values
+ *      len - Number of bytes in the buffer
+ *      scale - Scale factor (0 = 0%, 255 = 100%)
+ * Description:
+ *      Applies scale8 to every byte of a buffer.
+ *      A scale of 255 leaves the buffer untouched.
+ */
+void scale8_buf(uint8_t *buf, uint16_t len, uint8_t scale)
+{
+        if (scale == 255)
+                return;
+
+        for (uint16_t i = 0; i < len; i++)
+                buf[i] = scale8(buf[i], scale);
+}
+
+/* avg8
+ * ----
+ * Parameters:
+ *      sum - Sum of all samples
+ *      samples - Number of samples
+ * Returns:
+ *      The rounded average of the samples,
+ *      or 0 if no samples have been provided
+ * Description:
+ *      Integer equivalent of round((double)sum/samples).
+ *      Halves are rounded up, just like round() does
+ *      for positive values.
+ */
+uint8_t avg8(uint16_t sum, uint8_t samples)
+{
+        if (samples == 0)
+                return 0;
+
+        return (sum + (samples >> 1)) / samples;
+}
+
+// Hues
+
+/* hsv_apply_sv
+ * ------------
+ * Parameters:
+ *      rgb - Fully saturated RGB color at full brightness
+ *      sat - Saturation (0 = white, 255 = full color)
+ *      val - Value (0 = off, 255 = full brightness)
+ * Description:
+ *      Applies saturation and value to a hue. Both are skipped
+ *      at 255, so fully saturated colors cost no extra math.
+ */
+static inline void hsv_apply_sv(uint8_t *rgb, uint8_t sat, uint8_t val)
+{
+        if (sat != 255) {
+                uint8_t white = 255 - sat;
+
+                rgb[R] = scale8(rgb[R], sat) + white;
+                rgb[G] = scale8(rgb[G], sat) + white;
+                rgb[B] = scale8(rgb[B], sat) + white;
+        }
+
+        scale8_buf(rgb, 3, val);
+}
+
+/* hsv2rgb_spectrum
+ * ----------------
+ * Parameters:
+ *      hue - Hue (0 - HUE_MAX - 1)
+ *      sat - Saturation (0 = white, 255 = full color)
+ *      val - Value (0 = off, 255 = full brightness)
+ *      rgb - RGB object to store the color
+ * Description:
+ *      Converts a HSV color to RGB. Within each section of the
+ *      wheel, one channel fades out while the next one fades in,
+ *      which results in an even spectrum with rather dim
+ *      secondary colors (yellow, cyan, magenta).
+ */
+void hsv2rgb_spectrum(hue_t hue, uint8_t sat, uint8_t val, uint8_t *rgb)
+{
+        uint8_t up = hue & 0xFF;
+        uint8_t down = 255 - up;
+
+        switch (hue >> 8) {
+                case 0 : {
+                        rgb[R] = down;
+                        rgb[G] = up;
+                        rgb[B] = 0;
+                        break;
+                }
+                case 1 : {
+                        rgb[R] = 0;
+                        rgb[G] = down;
+                        rgb[B] = up;
+                        break;
+                }
+                default: {
+                        rgb[R] = up;
+                        rgb[G] = 0;
+                        rgb[B] = down;
+                        break;
+                }
+        }
+
+        hsv_apply_sv(rgb, sat, val);
+}
+
+/* hsv2rgb_rainbow
+ * ---------------
+ * Parameters:
+ *      hue - Hue (0 - HUE_MAX - 1)
+ *      sat - Saturation (0 = white, 255 = full color)
+ *      val - Value (0 = off, 255 = full brightness)
+ *      rgb - RGB object to store the color
+ * Description:
+ *      Same as hsv2rgb_spectrum, except that the red to green
+ *      section passes trough a bright yellow and orange, which
+ *      the eye perceives as a more evenly spaced rainbow.
+ */
+void hsv2rgb_rainbow(hue_t hue, uint8_t sat, uint8_t val, uint8_t *rgb)
+{
+        if ((hue >> 8) == 0) {
+                uint8_t f = hue & 0xFF;
+
+                // Red stays high until yellow, after which green saturates
+                if (f < 128) {
+                        rgb[R] = 255 - (f >> 1);
+                        rgb[G] = f + (f >> 1);
+                } else {
+                        f -= 128;
+                        rgb[R] = 191 - (f + (f >> 1));
+                        rgb[G] = 192 + (f >> 1);
+                }
+                rgb[B] = 0;
+
+                hsv_apply_sv(rgb, sat, val);
+        } else {
+                hsv2rgb_spectrum(hue, sat, val, rgb);
+        }
+}
+
+// Lookup tables
+
+// The tables below are generated at compile time. C++11 constexpr
+// functions consist of a single return statement, hence exp and ln
+// are evaluated as recursive series.
+
+#define CE_LN2 0.6931471805599453
+
+/* ce_exp
+ * ------
+ * Description:
+ *      Compile time e^x for x <= 0. The Taylor series is
+ *      evaluated for x/16 and the result squared four times.
+ */
+static constexpr double ce_exp_series(double x, double term, int n)
+{
+        return (n > 24) ? term : term + ce_exp_series(x, term * x / n, n + 1);
+}
+
+static constexpr double ce_sq(double x)
+{
+        return x * x;
+}
+
+static constexpr double ce_exp(double x)
+{
+        return ce_sq(ce_sq(ce_sq(ce_sq(ce_exp_series(x / 16, 1, 1)))));
+}
+
+/* ce_ln
+ * -----
+ * Description:
+ *      Compile time ln(x) for 0 < x <= 1. x is doubled until
+ *      it is >= 0.5, after which ln(x) = 2 * atanh((x - 1) / (x + 1))
+ *      converges quickly.
+ */
+static constexpr double ce_atanh_series(double y2, double p, int k)
+{
+        return (k > 41) ? 0 : p / k + ce_atanh_series(y2, p * y2, k + 2);
+}
+
+static constexpr double ce_ln(double x)
+{
+        return (x < 0.5) ? ce_ln(x * 2) - CE_LN2 :
+                2 * ce_atanh_series(ce_sq((x - 1) / (x + 1)), (x - 1) / (x + 1), 1);
+}
+
+static constexpr double ce_pow(double x, double e)
+{
+        return (x <= 0) ? 0 : ce_exp(e * ce_ln(x));
+}
+
+// Generates the 256 table entries from an entry macro
+#define G4(F, i)  F(i), F(i + 1), F(i + 2), F(i + 3)
+#define G16(F, i) G4(F, i), G4(F, i + 4), G4(F, i + 8), G4(F, i + 12)
+#define G64(F, i) G16(F, i), G16(F, i + 16), G16(F, i + 32), G16(F, i + 48)
+#define G256(F)   G64(F, 0), G64(F, 64), G64(F, 128), G64(F, 192)
+
+#ifdef GAMMA_CORRECTION
+
+#define GAMMA8_ENTRY(i) ((uint8_t) (255 * ce_pow((i) / 255.0, GAMMA_CORRECTION) + 0.5))
+
+constexpr uint8_t gamma8_table[256] PROGMEM = { G256(GAMMA8_ENTRY) };
+
+#endif
+
+#ifdef PERCEPTUAL_BRIGHTNESS
+
+// CIE 1931 lightness (L* = 0 - 100) to relative luminance (Y = 0 - 1)
+static constexpr double ce_cie_y(double l)
+{
+        return (l <= 8) ? l / 903.3 : ce_sq((l + 16) / 116) * ((l + 16) / 116);
+}
+
+#define CIE16_ENTRY(i) ((uint16_t) (65535 * ce_cie_y((i) * 100 / 255.0) + 0.5))
+
+constexpr uint16_t cie16_table[256] PROGMEM = { G256(CIE16_ENTRY) };
+
+#endif
@@ -0,0 +1,250 @@
+  /*
+   * Copyright (C) 2020  Patrick Pedersen
+
+   * This program is free software: you can redistribute it and/or modify
+   * it under the terms of the GNU General Public License as published by
+   * the Free Software Foundation, either version 3 of the License, or
+   * (at your option) any later version.
+
+   * This program is distributed in the hope that it will be useful,
+   * but WITHOUT ANY WARRANTY; without even the implied warranty of
+   * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   * GNU General Public License for more details.
+
+   * You should have received a copy of the GNU General Public License
+   * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+   * 
+   * Author: Patrick Pedersen <ctx.xda@gmail.com>
+   * Description: Exposes integer color math routines.
+   * 
+   */
+
+#pragma once
+
+#include <stdint.h>
+
+#include <avr/pgmspace.h>
+
+#include "config.h"
+
+/* scale8
+ * ------
+ * Parameters:
+ *      val - Value to be scaled
+ *      scale - Scale factor (0 = 0%, 255 = 100%)
+ * Returns:
+ *      round(val * scale / 255)
+ * Description:
+ *      Scales an 8-bit value without floating point math.
+ *      The division by 255 is replaced by a shift and add, which is
+ *      exact for every product of two 8-bit values. The result is
+ *      bit-identical to round(((double)scale/255) * (double)val).
+ */
+static inline uint8_t scale8(uint8_t val, uint8_t scale)
+{
+        uint16_t x = (uint16_t) val * scale + 127;
+        return (x + 1 + (x >> 8)) >> 8;
+}
+
+/* scale8_dither
+ * -------------
+ * Parameters:
+ *      val - Value to be scaled
+ *      scale - 16-bit scale factor (0 = 0%, 65535 = 100%)
+ *      dither - Rounding offset (0 - 255)
+ * Returns:
+ *      val * scale / 65535, rounded up or down depending on dither
+ * Description:
+ *      Scales a value by a 16-bit factor, keeping the fraction of the
+ *      result in 16 bits, and rounds the fraction with the provided
+ *      offset rather than to the nearest integer. Averaged over all
+ *      offsets, the result is val * scale / 65535 without rounding,
+ *      within 1/256. Scales of 0 and 65535 are exact for every
+ *      offset, so off and full brightness never flicker.
+ */
+static inline uint8_t scale8_dither(uint8_t val, uint16_t scale, uint8_t dither)
+{
+        uint32_t x = (uint32_t) val * scale;
+
+        // Rescale to x / 65535 in 8.16 fixed point
+        x += (x >> 16) + 1;
+
+        return (x + ((uint16_t) dither << 8)) >> 16;
+}
+
+/* round8
+ * ------
+ * Parameters:
+ *      val - 16-bit value (0 - 65535)
+ * Returns:
+ *      The value rounded to 8 bits (0 - 255), that is val / 257
+ * Description:
+ *      Reverses the conversion of an 8-bit value v to v * 257.
+ */
+static inline uint8_t round8(uint16_t val)
+{
+        uint32_t x = (uint32_t) val + 128;
+        return (x - (x >> 8)) >> 8;
+}
+
+void scale8_buf(uint8_t *buf, uint16_t len, uint8_t scale);
+uint8_t avg8(uint16_t sum, uint8_t samples);
+
+/* hue_t
+ * -----
+ * Description:
+ *      Fixed-point hue. The color wheel is split into three
+ *      sections (red to green, green to blue and blue to red)
+ *      of 256 steps each. The high byte selects the section,
+ *      the low byte the position within it.
+ */
+typedef uint16_t hue_t;
+
+#define HUE_MAX 768 // Hues wrap around at HUE_MAX
+
+/* hue_add
+ * -------
+ * Parameters:
+ *      hue - Hue
+ *      step - Steps to be added to the hue
+ * Returns:
+ *      The hue advanced by step, wrapped around HUE_MAX
+ */
+static inline hue_t hue_add(hue_t hue, uint16_t step)
+{
+        if (step >= HUE_MAX)
+                step %= HUE_MAX;
+
+        hue += step;
+        if (hue >= HUE_MAX)
+                hue -= HUE_MAX;
+
+        return hue;
+}
+
+/* hue_mul
+ * -------
+ * Parameters:
+ *      n - Number of steps
+ *      step - Hue steps per step
+ * Returns:
+ *      n * step, wrapped around HUE_MAX
+ * Description:
+ *      Takes two 8x8 bit multiplications and no division, as
+ *      HUE_MAX is 3 * 256 and 256, 16 and 4 are 1 modulo 3,
+ *      so it may be called between two pixels.
+ */
+static inline hue_t hue_mul(uint16_t n, uint8_t step)
+{
+        uint16_t lo = (uint16_t) (n & 0xFF) * step;
+        uint16_t hi = (uint16_t) (n >> 8) * step + (lo >> 8);
+
+        // hi % 3, the section of the result
+        hi = (hi >> 8) + (hi & 0xFF);
+        hi = (hi >> 4) + (hi & 0x0F);
+        hi = (hi >> 2) + (hi & 0x03);
+        hi = (hi >> 2) + (hi & 0x03);
+        if (hi >= 3)
+                hi -= 3;
+
+        return (hi << 8) | (lo & 0xFF);
+}
+
+void hsv2rgb_spectrum(hue_t hue, uint8_t sat, uint8_t val, uint8_t *rgb);
+void hsv2rgb_rainbow(hue_t hue, uint8_t sat, uint8_t val, uint8_t *rgb);
+
+/* hsv2rgb
+ * -------
+ * Parameters:
+ *      hue - Hue (0 - HUE_MAX - 1)
+ *      sat - Saturation (0 = white, 255 = full color)
+ *      val - Value (0 = off, 255 = full brightness)
+ *      rgb - RGB object to store the color
+ * Description:
+ *      Converts a HSV color to RGB, using the rainbow hues if
+ *      RAINBOW_HUES is set and the plain spectrum otherwise.
+ */
+static inline void hsv2rgb(hue_t hue, uint8_t sat, uint8_t val, uint8_t *rgb)
+{
+#ifdef RAINBOW_HUES
+        hsv2rgb_rainbow(hue, sat, val, rgb);
+#else
+        hsv2rgb_spectrum(hue, sat, val, rgb);
+#endif
+}
+
+/* gamma8
+ * ------
+ * Parameters:
+ *      val - Linear color value
+ * Returns:
+ *      Gamma corrected color value
+ * Description:
+ *      Maps a color value trough the gamma curve configured by
+ *      GAMMA_CORRECTION. The curve is generated at compile time
+ *      and stored in flash, so a lookup costs a few cycles.
+ *      Returns the value as is if gamma correction is disabled.
+ */
+#ifdef GAMMA_CORRECTION
+extern const uint8_t gamma8_table[256] PROGMEM;
+
+static inline uint8_t gamma8(uint8_t val)
+{
+        return pgm_read_byte(&gamma8_table[val]);
+}
+#else
+static inline uint8_t gamma8(uint8_t val)
+{
+        return val;
+}
+#endif
+
+/* cie16
+ * -----
+ * Parameters:
+ *      val - Brightness (0 = 0%, 255 = 100%)
+ * Returns:
+ *      16-bit luminance scale factor (0 - 65535)
+ * Description:
+ *      Maps a brightness value trough the CIE 1931 lightness
+ *      curve, so that equal brightness steps are perceived as
+ *      equal changes in brightness. The result keeps 16 bits,
+ *      so that low brightness levels can be dithered (see
+ *      scale8_dither). Returns val * 257 if PERCEPTUAL_BRIGHTNESS
+ *      is not set.
+ */
+#ifdef PERCEPTUAL_BRIGHTNESS
+extern const uint16_t cie16_table[256] PROGMEM;
+
+static inline uint16_t cie16(uint8_t val)
+{
+        return pgm_read_word(&cie16_table[val]);
+}
+#else
+static inline uint16_t cie16(uint8_t val)
+{
+        return (uint16_t) val * 257;
+}
+#endif
+
+/* cie8
+ * ----
+ * Parameters:
+ *      val - Brightness (0 = 0%, 255 = 100%)
+ * Returns:
+ *      Luminance scale factor
+ * Description:
+ *      Same as cie16, rounded to 8 bits. Returns the value
+ *      as is if PERCEPTUAL_BRIGHTNESS is not set.
+ */
+#ifdef PERCEPTUAL_BRIGHTNESS
+static inline uint8_t cie8(uint8_t val)
+{
+        return round8(cie16(val));
+}
+#else
+static inline uint8_t cie8(uint8_t val)
+{
+        return val;
+}
+#endif
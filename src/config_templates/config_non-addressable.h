@@ -62,7 +62,7 @@
                                  
 #define ADC_AVG_SAMPLES 255                                   // Max 255 - Number of samples used to determine the average potentiometer value.
                                                               // Increase this if the LED strip is noisy, especially at lower settings.
-                                                              // Higher values will reserve more runtime
+                                                              // Higher values respond slower to pot changes (and reserve more runtime on Arduino builds)
                                                               // Set to <= 1 or comment out to disable
 
 // #define POT_LOWER_BOUND 0                                  // Max 255 - Any potentiometer value lower or equal to the lower bound will disable the strip
@@ -77,10 +77,47 @@
 #define BTN_DEBOUNCE_TIME 100                                  // ms - Time to wait for button to debounce. Increasing this will reduce false trigger due to
                                                                // bouncing, but add a slight delay to color toggling.
                                                                // Set to 0 or comment out to disable
+
+// #define BTN_DOUBLE_CLICK_TIME 300                           // ms - Maximum time between two clicks to be registered as a double click,
+                                                               // which selects the previous patch. Single clicks are delayed by this time.
+                                                               // Set to 0 or comment out to disable
                                                 
-#define BTN_MIN_RELEASED_READS 300000                          // Reduce the read of false releases when holding down noisy push buttons. If your strip randomly
-                                                               // toggles while holding the button, set this value higher. Increasing this will add a delay to
-                                                               // button releases. Set to <= 1 or comment out to disable. 
+//////////////////////////////
+// Color Correction
+//////////////////////////////
+
+// #define GAMMA_CORRECTION 2.8                                // Gamma exponent applied to all colors before they are sent to the strip.
+                                                               // Makes color fades and low brightness levels appear smoother.
+                                                               // The correction curve is generated at compile time and stored in flash.
+                                                               // Comment out to disable
+
+// #define PERCEPTUAL_BRIGHTNESS                               // Maps brightness values (pot, fades) trough the CIE lightness curve, so that
+                                                               // the perceived brightness changes evenly across the entire pot range.
+                                                               // Comment out to disable
+
+// #define RAINBOW_HUES                                        // Rainbow effects pass trough a brighter orange and yellow, which appears more
+                                                               // evenly spaced than the plain RGB spectrum. Comment out to use the plain spectrum
+
+// #define TEMPORAL_DITHERING                                  // Spreads the remainder of the brightness scaling over successive frames, which smoothens
+                                                               // fades and low brightness levels. Requires a high and steady FRAME_RATE (100 fps or more)
+                                                               // to avoid flicker. Comment out to disable
+
+// #define COLOR_16BIT                                         // Stores substrip and pixel buffer colors with 16 bits per channel and only rounds
+                                                               // them to 8 bits on output, so that chained operations don't accumulate rounding
+                                                               // errors. Doubles the color memory of these buffers and adds two 8x16 bit multiplications
+                                                               // per channel to the output stage, which is estimated to roughly double its cost (not
+                                                               // measured on hardware, costly on ATtinys, which lack a hardware multiplier). The
+                                                               // *_color16 envs of platformio.ini build with it to compare RAM and flash.
+                                                               // Comment out to use 8-bit colors
+
+//////////////////////////////
+// Frame Timing
+//////////////////////////////
+
+#define FRAME_RATE 60                                          // fps - Rate at which the strip is updated. Animations advance by the time
+                                                               // passed between frames, so their speed does not depend on the strip length.
+                                                               // Frames that cannot be rendered in time are counted as dropped.
+                                                               // Set to 0 or comment out to update the strip as fast as possible
 
 //////////////////////////////
 // Patches
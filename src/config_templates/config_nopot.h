@@ -66,11 +66,125 @@
 #define BTN_DEBOUNCE_TIME 100                                  // ms - Time to wait for button to debounce. Increasing this will reduce false trigger due to
                                                                // bouncing, but add a slight delay to color toggling.
                                                                // Set to 0 or comment out to disable
+
+// #define BTN_DOUBLE_CLICK_TIME 300                           // ms - Maximum time between two clicks to be registered as a double click,
+                                                               // which selects the previous patch. Single clicks are delayed by this time.
+                                                               // Set to 0 or comment out to disable
                                                 
-// #define BTN_MIN_RELEASED_READS 0                            // Reduce the read of false releases when holding down noisy push buttons. If your strip randomly
-                                                               // toggles while holding the button, set this value higher. Increasing this will add a delay to
-                                                               // button releases. Set to <= 1 or comment out to disable. 
-                                                               
+//////////////////////////////
+// Color Correction
+//////////////////////////////
+
+// #define GAMMA_CORRECTION 2.8                                // Gamma exponent applied to all colors before they are sent to the strip.
+                                                               // Makes color fades and low brightness levels appear smoother.
+                                                               // The correction curve is generated at compile time and stored in flash.
+                                                               // Comment out to disable
+
+// #define PERCEPTUAL_BRIGHTNESS                               // Maps brightness values (pot, fades) trough the CIE lightness curve, so that
+                                                               // the perceived brightness changes evenly across the entire pot range.
+                                                               // Comment out to disable
+
+// #define RAINBOW_HUES                                        // Rainbow effects pass trough a brighter orange and yellow, which appears more
+                                                               // evenly spaced than the plain RGB spectrum. Comment out to use the plain spectrum
+
+// #define TEMPORAL_DITHERING                                  // Spreads the remainder of the brightness scaling over successive frames, which smoothens
+                                                               // fades and low brightness levels. Requires a high and steady FRAME_RATE (100 fps or more)
+                                                               // to avoid flicker. Comment out to disable
+
+// #define COLOR_16BIT                                         // Stores substrip and pixel buffer colors with 16 bits per channel and only rounds
+                                                               // them to 8 bits on output, so that chained operations don't accumulate rounding
+                                                               // errors. Doubles the color memory of these buffers and adds two 8x16 bit multiplications
+                                                               // per channel to the output stage, which is estimated to roughly double its cost (not
+                                                               // measured on hardware, costly on ATtinys, which lack a hardware multiplier). The
+                                                               // *_color16 envs of platformio.ini build with it to compare RAM and flash.
+                                                               // Comment out to use 8-bit colors
+
+//////////////////////////////
+// Power Limiting
+//////////////////////////////
+
+// #define POWER_LIMIT_MA 2000                                 // Current budget of the LED strip's power supply in mA. Frames that would draw more are
+                                                               // dimmed until they fit. Leave headroom for the idle current of the LEDs (~1 mA each)
+                                                               // and the controller. Max. 66000. Comment out to disable
+#define POWER_MA_PER_CHANNEL 20                                // Current of a single fully lit LED channel in mA (20 mA for most WS2812 LEDs)
+
+//////////////////////////////
+// Effects
+//////////////////////////////
+
+// #define HUE_RING_SIZE 128                                   // Max. number of pixels the rotating rainbow may precompute (3 bytes of RAM each).
+                                                               // Its hues repeat every 768 / gcd(step size, 768) pixels, so step sizes that divide
+                                                               // 768 (e.g. 8, 16, 32) repeat quickly. Longer periods are computed on the fly.
+                                                               // Set to 0 or comment out to disable
+
+#define PXBUF_SIZE 16                                          // Max. number of pixels in a pixel buffer, e.g. visible rain droplets (8 bytes of RAM
+                                                               // each, 11 with COLOR_16BIT). Pixel buffers are allocated statically at their full size
+
+#define FRAME_ARENA_SIZE 32                                    // Bytes of RAM for per-frame buffers, e.g. the substrips of PATCH_DISTRIBUTE (8 bytes
+                                                               // per color while sent, 11 with COLOR_16BIT). Frames that don't fit are not drawn
+
+// #define PALBUF_PIXELS 600                                   // Max. number of pixels of palettised buffers, e.g. of PATCH_ANIMATION_CYCLE_RAINBOW
+                                                               // (PALBUF_BITS / 8 bytes of RAM each, plus 27 bytes with 2 bits or 87 with 4 bits,
+                                                               // 39 or 135 with COLOR_16BIT). Pixels beyond are off. Comment out to disable
+// #define PALBUF_BITS 4                                       // Bits per palettised pixel, 4 (16 colors) or 2 (4 colors). Defaults to 2 on ATtinys.
+                                                               // Their palette takes 12 or 48 bytes of FRAME_ARENA_SIZE while sent
+
+// #define COMPOSITE_PIXELS 300                                // Max. number of pixels of composited frames, e.g. of PATCH_ANIMATION_RAIN_OVER_RAINBOW
+                                                               // (3 bytes of RAM each). Pixels beyond are off. Requires an ATmega328 or larger MCU.
+                                                               // Comment out to disable
+
+//////////////////////////////
+// Frame Timing
+//////////////////////////////
+
+#define FRAME_RATE 60                                          // fps - Rate at which the strip is updated. Animations advance by the time
+                                                               // passed between frames, so their speed does not depend on the strip length.
+                                                               // Frames that cannot be rendered in time are counted as dropped.
+                                                               // Set to 0 or comment out to update the strip as fast as possible
+
+////////////////////////
+// Mapping
+////////////////////////
+
+// Maps the strip that patches draw onto the physical strip. Mirrored and
+// tiled patches only draw half or a STRIP_MAP_TILES-th of the strip, which
+// is then replayed for every copy. With ZONES set, every zone is mapped
+// onto its own range. Patches drawn by a pixel generator (strip_apply_pxgen)
+// only save work if their half or tile fits into FRAME_ARENA_SIZE (3 bytes
+// per pixel), else every copy is generated again while it is sent, at the
+// cost of the full strip. The rotating rainbow is recomputed for every copy
+// unless its hues fit into the hue ring (see HUE_RING_SIZE).
+//   MAP_REVERSE - Patches start at the far end of the strip
+//   MAP_MIRROR - Patches are drawn from both ends towards the center
+//   MAP_TILE - Patches are repeated STRIP_MAP_TILES times
+//   MAP_SERPENTINE - 2D matrix wired in a serpentine of STRIP_MAP_WIDTH pixels
+//                    per row, every second row is reversed so that rows share
+//                    the same direction. The strip size should be a multiple
+//                    of STRIP_MAP_WIDTH.
+// Comment out to send patches to the strip as they are drawn.
+
+// #define STRIP_MAP MAP_MIRROR
+// #define STRIP_MAP_TILES 4                                   // Number of tiles of MAP_TILE
+// #define STRIP_MAP_WIDTH 16                                  // Pixels per row of MAP_SERPENTINE
+
+////////////////////////
+// Zones
+////////////////////////
+
+// Splits the strip into zones that are rendered by patches of their own,
+// for example to light a counter and a back wall from the same strip.
+// Zones are listed in ascending order as ZONE(start, length, patch), where
+// patch is the index of a patch below, or ZONE_SELECTED for the patch that
+// is selected by the push button. Pixels outside of zones are off. Every
+// patch may only be listed once, and patches listed here are skipped by the
+// push button. Every zone has timers and animation state of its own, so zones
+// may run the same animation, but the state of every animation in use (e.g.
+// the pixel buffer of a rain effect) takes its RAM once per zone. Another
+// FRAME_ARENA_SIZE bytes of RAM are split among the zones to keep their frames.
+// Comment out to render the selected patch across the entire strip.
+
+// #define ZONES ZONE(0, 30, ZONE_SELECTED) ZONE(30, 60, 1)
+
 ////////////////////////
 // Patches
 ////////////////////////
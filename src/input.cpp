@@ -18,26 +18,21 @@
  * 
  */
 
+#include <util/atomic.h>
+
 #include "config.h"
+#include "color.h"
 #include "input.h"
+#include "time.h"
 
 // Analog To Digital Converter
 
-/* adc_clear_mux_bits
- * ------------------
- * Description:
- *      Clears the ADMUX registers MUX (ls 4) bits
- *      so that the a new ADC channel can be selected
- */
-void adc_clear_mux_bits()
-{
-        ADMUX &= ~(1 << MUX0| 1 << MUX1 | 1 << MUX2 | 1 << MUX3);
-}
+#ifdef ARDUINO_BUILD
 
 /* adc_avg
  * -------
  * Parameters:
- *      adc - ADMUX mask for AVR native builds, ADC pin for Arduino builds 
+ *      adc - ADC pin
  *      num_samples - Number of ADC samples to be averaged (max 255)
  * Returns:
  *      Average 8-bit ADC reading
@@ -49,112 +44,264 @@ uint8_t adc_avg(uint8_t adc, uint8_t samples)
 {
         uint16_t ret = 0;
 
-#ifdef ARDUINO_BUILD
         for (uint8_t i = 0; i < samples; i++)
                 ret += analogRead(adc) >> 2;
+
+        return avg8(ret, samples);
+}
+
 #else
-        adc_clear_mux_bits();
-        ADMUX |= adc;
 
-        for (uint8_t i = 0; i < samples; i++) {
-                ADCSRA |= (1 << ADSC); // Trigger ADC
-                loop_until_bit_is_clear(ADCSRA, ADSC);
-                ret += ADCH;
-        }
+// The pot and CV inputs are sampled in the background by the ADC
+// interrupt, which alternates between both channels. Each pot sample
+// is fed into an exponential moving average with a time constant of
+// roughly ADC_AVG_SAMPLES samples, so that reads are constant-time.
+#ifndef BRIGHTNESS_POT_MISSING
+#define ADC_SAMPLE_POT
+#endif
 
+#ifdef CV_INPUT_ADMUX_MSK
+#define ADC_SAMPLE_CV
 #endif
 
-        return round((double)ret/samples);
-}
+#if defined(ADC_AVG_SAMPLES) && ADC_AVG_SAMPLES >= 128
+#define ADC_FILTER_SHIFT 7
+#elif defined(ADC_AVG_SAMPLES) && ADC_AVG_SAMPLES >= 64
+#define ADC_FILTER_SHIFT 6
+#elif defined(ADC_AVG_SAMPLES) && ADC_AVG_SAMPLES >= 32
+#define ADC_FILTER_SHIFT 5
+#elif defined(ADC_AVG_SAMPLES) && ADC_AVG_SAMPLES >= 16
+#define ADC_FILTER_SHIFT 4
+#elif defined(ADC_AVG_SAMPLES) && ADC_AVG_SAMPLES >= 8
+#define ADC_FILTER_SHIFT 3
+#elif defined(ADC_AVG_SAMPLES) && ADC_AVG_SAMPLES >= 4
+#define ADC_FILTER_SHIFT 2
+#elif defined(ADC_AVG_SAMPLES) && ADC_AVG_SAMPLES >= 2
+#define ADC_FILTER_SHIFT 1
+#else
+#define ADC_FILTER_SHIFT 0
+#endif
 
-// Potentiometer
+#define ADC_SMOOTH_SHIFT 7 // Time constant of ~128 samples for pot_smooth()
 
-/* pot()
- * -----
- * Returns:
- *      The currently set potentiometer value
+// Interrupt controlled
+#ifdef ADC_SAMPLE_POT
+volatile static uint16_t pot_acc = 0;        // Filtered pot value << ADC_FILTER_SHIFT
+volatile static uint16_t pot_smooth_acc = 0; // Filtered pot value << ADC_SMOOTH_SHIFT
+#endif
+#ifdef ADC_SAMPLE_CV
+volatile static uint8_t cv_sample = 0;       // Most recent CV sample
+#endif
+
+/* adc_clear_mux_bits
+ * ------------------
  * Description:
- *      Reads the current potentiometer value. Depending on the flags
- *      configured in config, this function may be as simple as
- *      simply returning the the current analog value of the pot
- *      input, or as complex as to calculate the average pot
- *      value.
+ *      Clears the ADMUX registers MUX (ls 4) bits
+ *      so that the a new ADC channel can be selected
  */
+static inline void adc_clear_mux_bits()
+{
+        ADMUX &= ~(1 << MUX0| 1 << MUX1 | 1 << MUX2 | 1 << MUX3);
+}
 
-uint8_t pot()
+#ifdef ADC_SAMPLE_POT
+
+/* pot_sample
+ * ----------
+ * Parameters:
+ *      sample - Pot ADC reading
+ * Description:
+ *      Feeds a new pot sample into the filters.
+ */
+static inline void pot_sample(uint8_t sample)
 {
-#ifndef BRIGHTNESS_POT_MISSING
-        uint8_t ret;
+        uint16_t acc = pot_acc;
+        uint16_t smooth_acc = pot_smooth_acc;
 
-#if defined(ADC_AVG_SAMPLES) && ADC_AVG_SAMPLES > 1
-        ret = adc_avg(BRIGHTNESS_POT_ADMUX_MSK, ADC_AVG_SAMPLES);
-#else
+        pot_acc = acc - (acc >> ADC_FILTER_SHIFT) + sample;
+        pot_smooth_acc = smooth_acc - (smooth_acc >> ADC_SMOOTH_SHIFT) + sample;
+}
 
-#ifdef ARDUINO_BUILD
-        ret = analogRead(BRIGHTNESS_POT) >> 2;
-#else
+#endif
+
+#if defined(ADC_SAMPLE_POT) || defined(ADC_SAMPLE_CV)
+
+/* adc_read
+ * --------
+ * Parameters:
+ *      adc - ADMUX mask of the channel
+ * Returns:
+ *      8-bit ADC reading
+ * Description:
+ *      Performs a single blocking conversion. Only used
+ *      before the ADC interrupt has been enabled.
+ */
+static uint8_t adc_read(uint8_t adc)
+{
         adc_clear_mux_bits();
-        ADMUX |= BRIGHTNESS_POT_ADMUX_MSK;
+        ADMUX |= adc;
         ADCSRA |= (1 << ADSC); // Trigger ADC
         loop_until_bit_is_clear(ADCSRA, ADSC);
-        ret = ADCH;
+        return ADCH;
+}
+
+/* ISR(ADC_vect)
+ * -------------
+ * Description:
+ *      Stores the completed conversion and starts
+ *      the next one on the other input channel.
+ */
+ISR(ADC_vect)
+{
+        uint8_t sample = ADCH;
+
+#if defined(ADC_SAMPLE_POT) && defined(ADC_SAMPLE_CV)
+        static bool cv_ch = false;
+
+        adc_clear_mux_bits();
+
+        if (cv_ch) {
+                cv_sample = sample;
+                ADMUX |= BRIGHTNESS_POT_ADMUX_MSK;
+        } else {
+                pot_sample(sample);
+                ADMUX |= CV_INPUT_ADMUX_MSK;
+        }
+
+        cv_ch = !cv_ch;
+#elif defined(ADC_SAMPLE_POT)
+        pot_sample(sample);
+#else
+        cv_sample = sample;
+#endif
+
+        ADCSRA |= (1 << ADSC); // Trigger next conversion
+}
+
+#endif
+
+/* adc_init
+ * --------
+ * Description:
+ *      Seeds the input filters with an initial reading and
+ *      starts sampling the pot and CV inputs in the background.
+ *      The ADC must be enabled and interrupts must still be
+ *      disabled when calling this function.
+ */
+void adc_init()
+{
+#ifdef ADC_SAMPLE_CV
+        cv_sample = adc_read(CV_INPUT_ADMUX_MSK);
 #endif
 
+#ifdef ADC_SAMPLE_POT
+        uint8_t sample = adc_read(BRIGHTNESS_POT_ADMUX_MSK);
+        pot_acc = (uint16_t) sample << ADC_FILTER_SHIFT;
+        pot_smooth_acc = (uint16_t) sample << ADC_SMOOTH_SHIFT;
 #endif
 
+#if defined(ADC_SAMPLE_POT) || defined(ADC_SAMPLE_CV)
+        ADCSRA |= (1 << ADIF); // Clear stale conversion flag
+        ADCSRA |= (1 << ADIE) | (1 << ADSC);
+#endif
+}
+
+#endif
+
+// Potentiometer
+
+#ifndef BRIGHTNESS_POT_MISSING
+
+/* pot_map
+ * -------
+ * Parameters:
+ *      val - Filtered 8-bit pot reading
+ * Returns:
+ *      Pot value with the configured inversion and bounds applied
+ */
+static uint8_t pot_map(uint8_t val)
+{
 #ifdef INVERT_POT
-        ret = ~ret;
+        val = ~val;
 #endif
 
 #if defined(POT_LOWER_BOUND) && POT_LOWER_BOUND > 0
-        if (ret <= POT_LOWER_BOUND)
+        if (val <= POT_LOWER_BOUND)
                 return 0;
 #endif
 
 #if defined(POT_UPPER_BOUND) && POT_UPPER_BOUND < 255
-        if (ret >= POT_UPPER_BOUND)
+        if (val >= POT_UPPER_BOUND)
                 return 255;
 #endif
 
-        return ret;
-#else
-        return 255;
-#endif
+        return val;
 }
 
-/* pot_avg()
+#endif
+
+/* pot()
  * -----
  * Returns:
- *      The average potentiometer value with n samples
+ *      The currently set potentiometer value
  * Description:
- *      Same as pot() except that the sample size for averaging isn't
- *      configuration defined but provided as a parameter.
- *      This is practical if average potentiometer readings
- *      are certainly required and are not simply an option.
+ *      Reads the current potentiometer value. On AVR native
+ *      builds, this returns the filtered value maintained by
+ *      the ADC interrupt and never waits for a conversion.
+ *      Arduino builds convert, and optionally average, on
+ *      every call.
  */
-uint8_t pot_avg(uint8_t samples) {
+
+uint8_t pot()
+{
 #ifndef BRIGHTNESS_POT_MISSING
+        uint8_t ret;
+
 #ifdef ARDUINO_BUILD
-        uint8_t ret = adc_avg(BRIGHTNESS_POT, samples);
+
+#if defined(ADC_AVG_SAMPLES) && ADC_AVG_SAMPLES > 1
+        ret = adc_avg(BRIGHTNESS_POT, ADC_AVG_SAMPLES);
 #else
-        uint8_t ret = adc_avg(BRIGHTNESS_POT_ADMUX_MSK, samples);
+        ret = analogRead(BRIGHTNESS_POT) >> 2;
 #endif
 
-#ifdef INVERT_POT
-        ret = ~ret;
+#else
+        ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+                ret = pot_acc >> ADC_FILTER_SHIFT;
+        }
 #endif
 
-#if defined(POT_LOWER_BOUND) && POT_LOWER_BOUND > 0
-        if (ret <= POT_LOWER_BOUND)
-                return 0;
+        return pot_map(ret);
+#else
+        return 255;
 #endif
+}
 
-#if defined(POT_UPPER_BOUND) && POT_UPPER_BOUND < 255
-        if (ret >= POT_UPPER_BOUND)
-                return 255;
+/* pot_smooth()
+ * ------------
+ * Returns:
+ *      The heavily filtered potentiometer value
+ * Description:
+ *      Same as pot() except that the value is filtered over
+ *      ~128 samples, regardless of ADC_AVG_SAMPLES. This is
+ *      practical if steady readings are certainly required
+ *      and are not simply an option, such as for calibration.
+ *      On Arduino builds, this blocks while 255 samples are taken.
+ */
+uint8_t pot_smooth()
+{
+#ifndef BRIGHTNESS_POT_MISSING
+        uint8_t ret;
+
+#ifdef ARDUINO_BUILD
+        ret = adc_avg(BRIGHTNESS_POT, 255);
+#else
+        ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+                ret = pot_smooth_acc >> ADC_SMOOTH_SHIFT;
+        }
 #endif
 
-        return ret;    
+        return pot_map(ret);
 #else
         return 255;
 #endif
@@ -163,14 +310,219 @@ uint8_t pot_avg(uint8_t samples) {
 #if defined(CV_INPUT_ADMUX_MSK) || defined(CV_INPUT)
 uint8_t cv()
 {
-#ifdef ARDUINO
+#ifdef ARDUINO_BUILD
         return analogRead(CV_INPUT) >> 2;
 #else
-        adc_clear_mux_bits();
-        ADMUX |= CV_INPUT_ADMUX_MSK;
-        ADCSRA |= (1 << ADSC); // Trigger ADC
-        loop_until_bit_is_clear(ADCSRA, ADSC);
-        return ADCH;
+        return cv_sample;
 #endif
 }
-#endif
\ No newline at end of file
+#endif
+
+// Push Button
+
+#ifndef BTN_DEBOUNCE_TIME
+#define BTN_DEBOUNCE_TIME 0
+#endif
+
+// Releases are debounced by BTN_DEBOUNCE_TIME just like presses
+#ifdef BTN_MIN_RELEASED_READS
+#warning "BTN_MIN_RELEASED_READS is no longer supported! Please use BTN_DEBOUNCE_TIME to debounce releases instead!"
+#endif
+
+#ifndef BTN_LONG_PRESS_TIME
+#define BTN_LONG_PRESS_TIME 1000
+#endif
+
+#ifndef BTN_REPEAT_TIME
+#define BTN_REPEAT_TIME 100
+#endif
+
+#define BTN_QUEUE_SIZE 4 // Must be a power of two
+
+#if defined(__AVR_ATtiny25__) || defined(__AVR_ATtiny45__) || defined(__AVR_ATtiny85__)
+#define BTN_TIMSK TIMSK
+#else
+#define BTN_TIMSK TIMSK0
+#endif
+
+// Interrupt controlled
+volatile static uint8_t btn_queue[BTN_QUEUE_SIZE]; // Ring buffer of pending events
+volatile static uint8_t btn_head = 0;               // Next free slot
+volatile static uint8_t btn_tail = 0;               // Oldest pending event
+volatile static bool btn_down = false;              // Debounced button state
+volatile static uint16_t btn_held_ms = 0;           // Time the button has been held down
+
+/* btn_push
+ * --------
+ * Parameters:
+ *      evt - Button event
+ * Description:
+ *      Queues a button event. Events are dropped
+ *      if the queue is full.
+ */
+static inline void btn_push(uint8_t evt)
+{
+        uint8_t next = (btn_head + 1) & (BTN_QUEUE_SIZE - 1);
+
+        if (next != btn_tail) {
+                btn_queue[btn_head] = evt;
+                btn_head = next;
+        }
+}
+
+/* ISR(TIMER0_COMPA_vect)
+ * ----------------------
+ * Description:
+ *      Samples the button roughly once every millisecond
+ *      and turns its debounced state into events. Uses the
+ *      compare match of timer0, whose overflow is already
+ *      taken by the clock. The compare match occurs once
+ *      per timer period, regardless of the OCR0A value.
+ */
+ISR(TIMER0_COMPA_vect)
+{
+        static uint8_t bounce = 0;      // Time the raw state has differed from the debounced state
+        static uint16_t repeat = 0;     // Time since the last long press or hold repeat event
+        static bool long_press = false; // A long press has been emitted for the current press
+#if defined(BTN_DOUBLE_CLICK_TIME) && BTN_DOUBLE_CLICK_TIME > 0
+        static uint16_t gap = 0;        // Time since the first click of a potential double click
+        static bool click = false;      // A click awaits a potential second click
+#endif
+
+        bool raw = BTN_STATE;
+
+        if (raw == btn_down) {
+                bounce = 0;
+        } else if (++bounce > BTN_DEBOUNCE_TIME) {
+                bounce = 0;
+                btn_down = raw;
+
+                if (raw) { // Press
+                        long_press = false;
+                } else if (!long_press) { // Release
+#if defined(BTN_DOUBLE_CLICK_TIME) && BTN_DOUBLE_CLICK_TIME > 0
+                        if (click) {
+                                btn_push(BTN_DOUBLE_CLICK);
+                                click = false;
+                        } else {
+                                click = true;
+                                gap = 0;
+                        }
+#else
+                        btn_push(BTN_CLICK);
+#endif
+                }
+        }
+
+        if (btn_down) {
+                if (btn_held_ms < 0xFFFF)
+                        btn_held_ms++;
+
+                if (btn_held_ms == BTN_LONG_PRESS_TIME) {
+                        btn_push(BTN_LONG_PRESS);
+                        long_press = true;
+                        repeat = 0;
+                } else if (long_press && ++repeat >= BTN_REPEAT_TIME) {
+                        btn_push(BTN_HOLD_REPEAT);
+                        repeat = 0;
+                }
+        } else {
+                btn_held_ms = 0;
+        }
+
+#if defined(BTN_DOUBLE_CLICK_TIME) && BTN_DOUBLE_CLICK_TIME > 0
+        // No second click within time, emit the single click
+        if (click && !btn_down && ++gap >= BTN_DOUBLE_CLICK_TIME) {
+                btn_push(BTN_CLICK);
+                click = false;
+        }
+#endif
+}
+
+/* btn_init
+ * --------
+ * Description:
+ *      Starts sampling the push button in the background.
+ *      Timer0 must already be running.
+ */
+void btn_init()
+{
+        btn_down = BTN_STATE;
+        BTN_TIMSK |= (1 << OCIE0A); // Enable compare match interrupt
+}
+
+/* btn_event
+ * ---------
+ * Returns:
+ *      The oldest queued button event, or BTN_NONE
+ *      if no event is pending
+ */
+uint8_t btn_event()
+{
+        uint8_t evt = BTN_NONE;
+
+        ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+                if (btn_tail != btn_head) {
+                        evt = btn_queue[btn_tail];
+                        btn_tail = (btn_tail + 1) & (BTN_QUEUE_SIZE - 1);
+                }
+        }
+
+        return evt;
+}
+
+/* btn_held
+ * --------
+ * Returns:
+ *      Time in ms the button has been held down,
+ *      or 0 if the button is released
+ */
+uint16_t btn_held()
+{
+        uint16_t ret;
+
+        ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+                ret = btn_held_ms;
+        }
+
+        return ret;
+}
+
+/* btn_flush
+ * ---------
+ * Description:
+ *      Discards all queued button events.
+ */
+void btn_flush()
+{
+        ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+                btn_tail = btn_head;
+        }
+}
+
+// Input Frame
+
+/* input_capture
+ * -------------
+ * Parameters:
+ *      in - Input frame to be filled
+ * Description:
+ *      Captures the current state of all inputs into
+ *      the provided input frame.
+ */
+void input_capture(input_frame *in)
+{
+        in->pot = pot();
+
+#if defined(CV_INPUT_ADMUX_MSK) || defined(CV_INPUT)
+        in->cv = cv();
+#else
+        in->cv = 0;
+#endif
+
+        in->btn = btn_down;
+        in->btn_held = btn_held();
+        in->btn_evt = btn_event();
+        in->ms = clock_ms();
+        in->dt = frame_dt;
+}
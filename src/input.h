@@ -23,7 +23,6 @@
 #include <stdlib.h>
 #include <stdbool.h>
 #include <stdint.h>
-#include <math.h>
 
 #ifdef ARDUINO_BUILD
 #include <Arduino.h>
@@ -39,7 +38,45 @@
 #define BTN_STATE !(PINB & (1 << BTN))
 #endif
 
+// Button events (see btn_event)
+enum btn_evt {
+        BTN_NONE,               // No event
+        BTN_CLICK,              // Short press and release
+        BTN_DOUBLE_CLICK,       // Two clicks within BTN_DOUBLE_CLICK_TIME
+        BTN_LONG_PRESS,         // Button held for BTN_LONG_PRESS_TIME
+        BTN_HOLD_REPEAT         // Emitted every BTN_REPEAT_TIME after a long press
+};
+
+/* input_frame
+ * -----------
+ * Description:
+ *      Snapshot of all inputs, captured once per main loop
+ *      iteration (see input_capture) and handed to the patches.
+ *      All patches of a frame thereby see the same input values.
+ */
+typedef struct input_frame {
+        uint8_t pot;    // Potentiometer value (255 if no pot is present)
+        uint8_t cv;     // CV input value (0 if no CV input is present)
+        bool btn;       // Debounced button state (true = pressed)
+        uint16_t btn_held; // Time in ms the button has been held down (0 if released)
+        uint8_t btn_evt;   // Next queued button event (see btn_evt)
+        uint32_t ms;    // Clock reading (ms) at capture time
+        uint16_t dt;    // Time in ms since the previous frame
+} input_frame;
+
+void input_capture(input_frame *in);
+
+void btn_init();
+uint8_t btn_event();
+uint16_t btn_held();
+void btn_flush();
+
+#ifdef ARDUINO_BUILD
 uint8_t adc_avg(uint8_t adc, uint8_t samples);
+#else
+void adc_init();
+#endif
+
 uint8_t pot();
-uint8_t pot_avg(uint8_t samples);
+uint8_t pot_smooth();
 uint8_t cv();
@@ -27,6 +27,7 @@
 #include <avr/io.h>
 #include <avr/interrupt.h>
 #include <avr/eeprom.h>
+#include <avr/sleep.h>
 #include <util/delay.h>
 
 #ifdef ARDUINO_BUILD
@@ -95,13 +96,19 @@ uint8_t selected_patch;
 
 /* update_strip
  * ----------
+ * Parameters:
+ *      patch - Patch to be rendered
+ *      in - Input frame of the current main loop iteration
  * Description:
  *      Updates the strip for the provided patch.
  *      For animations, this function must be called
- *      repeatedly.
+ *      repeatedly. Patches read their inputs from the
+ *      provided input frame (in).
  */
-void update_strip(uint8_t patch)
+void update_strip(uint8_t patch, const input_frame *in)
 {
+        strip_set_brightness(MAX_BRIGHTNESS);
+
         switch (patch) {
                 case 0 : {
                         PATCH_0;
@@ -149,6 +156,57 @@ void update_strip(uint8_t patch)
         }
 }
 
+/* select_patch
+ * ------------
+ * Parameters:
+ *      step - 1 for the next, NUM_PATCHES - 1 for the previous patch
+ * Description:
+ *      Steps through the patch list. With ZONES set, patches that
+ *      are rendered by a zone of their own are skipped.
+ */
+void select_patch(uint8_t step)
+{
+        for (uint8_t i = 0; i < NUM_PATCHES; i++) {
+                selected_patch = (selected_patch + step) % NUM_PATCHES;
+#ifdef ZONES
+                if (zone_patch_fixed(selected_patch))
+                        continue;
+#endif
+                return;
+        }
+}
+
+/* render
+ * ------
+ * Parameters:
+ *      in - Input frame of the current main loop iteration
+ * Description:
+ *      Renders the next frame. Allocations of the previous
+ *      frame (see strip_arena_alloc) are released first. With
+ *      ZONES set, the patch of every zone is rendered into its
+ *      range of the strip, and all zones are sent in a single pass.
+ */
+void render(const input_frame *in)
+{
+#if STRIP_TYPE == WS2812
+        strip_arena_reset();
+        strip_frame_begin();
+#endif
+
+#ifdef ZONES
+        for (uint8_t z = 0; z < num_zones; z++) {
+                if (strip_zone_begin(z))
+                        update_strip((zones[z].patch == ZONE_SELECTED) ? selected_patch : zones[z].patch, in);
+        }
+#else
+        update_strip(selected_patch, in);
+#endif
+
+#if STRIP_TYPE == WS2812
+        strip_frame_end();
+#endif
+}
+
 ////////////////////////
 // Main routine
 ////////////////////////
@@ -156,6 +214,8 @@ void update_strip(uint8_t patch)
 void _main() {
         DELAY_MS(10);                         // Allow supply voltage to calm down 
 
+        set_sleep_mode(SLEEP_MODE_IDLE);      // Timers and the ADC keep running while idle
+
         // Calibration
 #if STRIP_TYPE == WS2812
         strip_size = GET_STRIP_SIZE;
@@ -164,49 +224,58 @@ void _main() {
 #endif
 
         // Patches
-        selected_patch = 0;
-        update_strip(selected_patch);
+        input_frame in;
+
+        // First patch that isn't rendered by a zone of its own
+        selected_patch = NUM_PATCHES - 1;
+        select_patch(1);
+        input_capture(&in);
+        render(&in);
         
         // Main loop
 
-        bool prev_btn_state = BTN_STATE;
+#if STRIP_TYPE == WS2812 && !defined(STRIP_SIZE)
         bool calibrated = false;
+#endif
 
         while(true) {
-                bool btn_state = BTN_STATE;
+                frame_sync();
+                input_capture(&in);
 
-                if (!prev_btn_state && btn_state) { // Button press
-#if defined(BTN_DEBOUNCE_TIME) && BTN_DEBOUNCE_TIME > 0
-                        DELAY_MS(BTN_DEBOUNCE_TIME);
-#endif
-
-#if STRIP_TYPE == WS2812
-                        reset_timer();
-#endif
+                switch (in.btn_evt) {
+                        case BTN_CLICK : {
+                                select_patch(1);
+                                break;
+                        }
+                        case BTN_DOUBLE_CLICK : {
+                                select_patch(NUM_PATCHES - 1);
+                                break;
+                        }
+                        default: {
+                                break;
+                        }
                 }
 
 #if STRIP_TYPE == WS2812 && !defined(STRIP_SIZE)
-                else if (btn_state) {
-                        if (ms_passed() >= 5000) {
-                                strip_calibrate();
-                                calibrated = true;
-                        }
-                        
+                // Button held for 5 seconds, recalibrate strip
+                if (in.btn_held >= 5000 && !calibrated) {
+                        strip_calibrate();
+                        calibrated = true;
                         continue;
                 }
+
+                // Only recalibrate once per hold
+                if (!in.btn)
+                        calibrated = false;
 #endif
 
-                else if (prev_btn_state && !btn_state) { // Button Released
-                        if (calibrated) {
-                                calibrated = false;
-                        } else {
-                                selected_patch = (selected_patch + 1) % NUM_PATCHES;
-                                update_strip(selected_patch);
-                        }
-                }
+                render(&in);
 
-                prev_btn_state = btn_state;
-                update_strip(selected_patch);
+#if STRIP_TYPE == WS2812 && !(defined(FRAME_RATE) && FRAME_RATE > 0)
+                // Strip content hasn't changed, idle until the next interrupt
+                if (strip_tx_skipped())
+                        sleep_mode();
+#endif
         }
 }
 
@@ -219,6 +288,7 @@ void setup() {
         Serial.begin(9600);
         pinMode(WS2812_DIN, OUTPUT);
         pinMode(BTN, INPUT_PULLUP);
+        btn_init();
 #ifndef BRIGHTNESS_POT_MISSING
         pinMode(BRIGHTNESS_POT, INPUT);
 #endif
@@ -241,7 +311,7 @@ int main()
 
         // Timer 0
 
-        TCCR0B |= (1 << CS00);                // No prescaling
+        TCCR0B |= (1 << CS01) | (1 << CS00);  // Prescaler 64 (see CLOCK_PRESCALER)
 
 #if defined(__AVR_ATmega328__) || defined(__AVR_ATmega328P__)
         TIMSK0 |= (1 << TOIE0);                // Enable Timer interrupts
@@ -288,6 +358,7 @@ int main()
 
         DDRB &= ~(1 << BTN);                  // Set button pin to input
         PORTB |= (1 << BTN);                  // Enable internal pull-up on Button pin
+        btn_init();                           // Sample button in the background
 
         // ADC
         ADMUX = (1 << ADLAR); // Reduce ADC input to 8-bit value (0-255)
@@ -302,11 +373,12 @@ int main()
 
         ADCSRA = 
                 (1 << ADEN)  |                // Enable ADC
-                (1 << ADSC)  |                // Start first conversion 
                 (1 << ADPS2) |                // set prescaler to 128, bit 2 
                 (1 << ADPS1) |                // set prescaler to 128, bit 1 
                 (1 << ADPS0);                 // set prescaler to 128, bit 0
 
+        adc_init();                           // Sample pot and CV in the background
+
         sei();
 
         _main();
@@ -22,9 +22,18 @@
 #pragma once
 
 #include "config.h"
+#include "input.h"
 #include "strip.h"
 #include "time.h"
 
+// Patches are expanded within update_strip() (see main.cpp), where
+// the inputs of the current frame are provided by the input frame 'in'
+// (see input_frame in input.h). Patches must read their inputs from
+// it rather than calling pot() or cv(), so that all reads within a
+// frame agree with each other. Likewise, animations take their time
+// from in->ms and in->dt (see timer_elapsed and the strip_* effects)
+// rather than from the clock.
+
 #define RGB_ARRAY(...) __VA_ARGS__ 
 
 //////////////////////////////////
@@ -43,22 +52,21 @@
  */
 #define PATCH_SET_ALL(R, G, B) \
         RGB_t rgb = {R, G, B}; \
-        rgb_apply_brightness(rgb, pot()); \
+        strip_set_brightness(in->pot); \
         strip_apply_all(rgb);
 
 #define PATCH_SPLIT(R1, G1, B1, R2, G2, B2, SPLIT) \
-        static substrpbuf buf = {2, NULL}; \
-        if (!buf.substrps) \
-                buf.substrps = (substrp *)malloc(sizeof(substrp) * 2); \
+        static substrp substrps[2]; \
+        substrpbuf buf = {2, substrps}; \
         buf.substrps[0].length = SPLIT; \
-        buf.substrps[0].rgb[R] = R1; \
-        buf.substrps[0].rgb[G] = G1; \
-        buf.substrps[0].rgb[B] = B1; \
+        buf.substrps[0].rgb[R] = COLOR8(R1); \
+        buf.substrps[0].rgb[G] = COLOR8(G1); \
+        buf.substrps[0].rgb[B] = COLOR8(B1); \
         buf.substrps[1].length = strip_size - SPLIT; \
-        buf.substrps[1].rgb[R] = R2; \
-        buf.substrps[1].rgb[G] = G2; \
-        buf.substrps[1].rgb[B] = B2; \
-        substripbuf_apply_brightness(&buf, pot()); \
+        buf.substrps[1].rgb[R] = COLOR8(R2); \
+        buf.substrps[1].rgb[G] = COLOR8(G2); \
+        buf.substrps[1].rgb[B] = COLOR8(B2); \
+        strip_set_brightness(in->pot); \
         strip_apply_substrpbuf(buf);
 
 /* PATCH_DISTRIBUTE
@@ -73,9 +81,7 @@
         RGB_t rgb[] = { \
                 RGB_ARR \
         }; \
-        uint8_t brightness = pot(); \
-        for (uint16_t i = 0; i < sizeof(rgb)/sizeof(RGB_t); i++) \
-                rgb_apply_brightness(rgb[i], brightness); \
+        strip_set_brightness(in->pot); \
         strip_distribute_rgb(rgb, sizeof(rgb)/sizeof(RGB_t));
 
 /* PATCH_DIAL_RGB
@@ -85,7 +91,7 @@
  * Description:
  *      Dials a color within RGB spectrum with the potentiometer
  */
-#define PATCH_DIAL_RGB(BRIGHTNESS) strip_scroll_rgb(pot() * 3, BRIGHTNESS)
+#define PATCH_DIAL_RGB(BRIGHTNESS) strip_scroll_rgb(in->pot * 3, BRIGHTNESS)
 
 
 /* --------------------------------
@@ -94,11 +100,11 @@
 
 #define PATCH_SET_ALL_GATED(R_HI, G_HI, B_HI, R_LO, G_LO, B_LO, TRIGGER) \
         RGB_t rgb; \
-        if (cv() >= TRIGGER) { \
+        if (in->cv >= TRIGGER) { \
                 rgb[R] = R_HI; \
                 rgb[G] = G_HI; \
                 rgb[B] = B_HI; \
-                rgb_apply_brightness(rgb, pot()); \
+                strip_set_brightness(in->pot); \
         } else { \
                 rgb[R] = R_LO; \
                 rgb[G] = G_LO; \
@@ -110,14 +116,14 @@
         static bool prev_trigger = false; \
         static bool toggle = false; \
         RGB_t rgb; \
-        bool trigger = (cv() >= TRIGGER); \
+        bool trigger = (in->cv >= TRIGGER); \
         if (!prev_trigger && trigger) \
                 toggle = !toggle; \
         if (toggle) { \
                 rgb[R] = R1; \
                 rgb[G] = G1; \
                 rgb[B] = B1; \
-                rgb_apply_brightness(rgb, pot()); \
+                strip_set_brightness(in->pot); \
         } else { \
                 rgb[R] = R2; \
                 rgb[G] = G2; \
@@ -143,7 +149,7 @@
  *      Gradiently fades all LEDs simultaneously trough the RGB spectrum.
  *      Supported on non-addressable strips.
  */
-#define PATCH_ANIMATION_RAINBOW(STEP_SIZE, DELAY, BRIGHTNESS) strip_rainbow(STEP_SIZE, DELAY, BRIGHTNESS)
+#define PATCH_ANIMATION_RAINBOW(STEP_SIZE, DELAY, BRIGHTNESS) strip_rainbow(in, STEP_SIZE, DELAY, BRIGHTNESS)
 
 /* PATCH_ANIMATION_ROTATE_RAINBOW
  * ------------------------------
@@ -153,7 +159,21 @@
  * Description:
  *      Rotates the rgb spectrum across the strip.
  */
-#define PATCH_ANIMATION_ROTATE_RAINBOW(STEP_SIZE, DELAY) strip_rotate_rainbow(STEP_SIZE, DELAY);
+#define PATCH_ANIMATION_ROTATE_RAINBOW(STEP_SIZE, DELAY) strip_rotate_rainbow(in, STEP_SIZE, DELAY);
+
+/* PATCH_ANIMATION_CYCLE_RAINBOW
+ * -----------------------------
+ * Parameters:
+ *      BAND_WIDTH - Pixels per color band
+ *      DELAY - Delay between each step in ms
+ * Description:
+ *      Rotates bands of 16 rainbow colors (4 with PALBUF_BITS 2,
+ *      the default on ATtinys) across the strip by
+ *      cycling the palette of a palettised buffer. Requires
+ *      PALBUF_PIXELS to be set in the config file.
+ *      Only supported on addressable strips.
+ */
+#define PATCH_ANIMATION_CYCLE_RAINBOW(BAND_WIDTH, DELAY) strip_cycle_rainbow(in, BAND_WIDTH, DELAY);
 
 /* PATCH_ANIMATION_SWAP
  * --------------------
@@ -171,14 +191,14 @@
  */
 #define PATCH_ANIMATION_SWAP(RFH, GFH, BFH, RSH, GSH, BSH, SWAP_TIME) \
         static bool swap = false; \
-        if (ms_passed() >= SWAP_TIME) { \
+        if (timer_elapsed(TMR_ANIM, in->ms) >= SWAP_TIME) { \
                 if (swap) { \
                         PATCH_DISTRIBUTE(RGB_ARRAY({RFH, GFH, BFH}, {RSH, GSH, BSH})); \
                 } else { \
                         PATCH_DISTRIBUTE(RGB_ARRAY({RSH, GSH, BSH}, {RFH, GFH, BFH})); \
                 } \
                 swap = !swap; \
-                reset_timer(); \
+                timer_reset(TMR_ANIM, in->ms); \
         }
 
 /* PATCH_ANIMATION_RAIN
@@ -193,8 +213,9 @@
  *      DELAY - Delay of droplet fading
  * Description:
  *      Creates a rain effect across the strip.
- *      Note that this effect makes use of an RGB buffer and will linearly increase 
- *      memory consumption with strip size. 
+ *      Droplets are kept in a pixel buffer of PXBUF_SIZE pixels, so
+ *      memory does not grow with the strip size, but MAX_DROPS is
+ *      capped at PXBUF_SIZE (16 on the ATtiny config templates).
  *      Only supported on addressable strips.
  */
 #define PATCH_ANIMATION_RAIN(_R, _G, _B, MAX_DROPS, MIN_T_APPART, MAX_T_APPART, DELAY) \
@@ -202,27 +223,51 @@
         rgb[R] = _R; \
         rgb[G] = _G; \
         rgb[B] = _B; \
-        strip_rain(rgb, MAX_DROPS, MIN_T_APPART, MAX_T_APPART, DELAY);
+        strip_rain(in, rgb, MAX_DROPS, MIN_T_APPART, MAX_T_APPART, DELAY);
+
+/* PATCH_ANIMATION_RAIN_OVER_RAINBOW
+ * ---------------------------------
+ * Parameters:
+ *      _R - Red color value
+ *      _G - Green color value
+ *      _B - Blue color value
+ *      MAX_DROPS - Maximum amount of visible "droplets" at a time
+ *      MIN_T_APPART - Minimum time in ms between drops
+ *      MAX_T_APPART - Maximum time in ms between drops
+ *      DELAY - Delay of droplet fading
+ *      STEP_SIZE - Color steps (0 - 255) between each pixel of the rainbow
+ *      RAINBOW_DELAY - Delay between each step of the rainbow in ms
+ * Description:
+ *      Creates a rain effect over a rotating rainbow.
+ *      Requires COMPOSITE_PIXELS to be set in the config file.
+ *      Only supported on addressable strips and ATmega328 or larger MCUs.
+ */
+#define PATCH_ANIMATION_RAIN_OVER_RAINBOW(_R, _G, _B, MAX_DROPS, MIN_T_APPART, MAX_T_APPART, DELAY, STEP_SIZE, RAINBOW_DELAY) \
+        RGB_t rgb; \
+        rgb[R] = _R; \
+        rgb[G] = _G; \
+        rgb[B] = _B; \
+        strip_rain_over_rainbow(in, rgb, MAX_DROPS, MIN_T_APPART, MAX_T_APPART, DELAY, STEP_SIZE, RAINBOW_DELAY);
 
 #define PATCH_ANIMATION_OVERRIDE_ARR(RGB_ARR, DELAY) \
         RGB_t rgb[] = { \
                 RGB_ARR \
         }; \
-        strip_override_array(rgb, sizeof(rgb)/sizeof(RGB_t), DELAY);
+        strip_override_array(in, rgb, sizeof(rgb)/sizeof(RGB_t), DELAY);
 
 #define PATCH_ANIMATION_OVERRIDE_RAND(DELAY) \
         static RGB_t rgb = {255, 255, 255}; \
-        if (strip_override(rgb, DELAY)) { \
+        if (strip_override(in, rgb, DELAY)) { \
                 rgb[R] = rand() % 256; \
                 rgb[G] = rand() % 256; \
                 rgb[B] = rand() % 256; \
         }
 
-#define PATCH_ANIMATION_OVERRIDE_RAINBOW(DELAY, STEP_SIZE) strip_override_rainbow(DELAY, STEP_SIZE);
+#define PATCH_ANIMATION_OVERRIDE_RAINBOW(DELAY, STEP_SIZE) strip_override_rainbow(in, DELAY, STEP_SIZE);
 
 #define PATCH_ANIMATION_FADE(R, G, B, DELAY_MS, STEP_SIZE) \
         RGB_t rgb = {R, G, B}; \
-        strip_fade(rgb, DELAY_MS, STEP_SIZE, false);
+        strip_fade(in, rgb, DELAY_MS, STEP_SIZE, false);
 
 /* PATCH_ANIMATION_BREATHE
  * --------------------------------
@@ -238,7 +283,7 @@
  */
 #define PATCH_ANIMATION_BREATHE(R, G, B, STEP_SIZE) \
         RGB_t rgb = {R, G, B}; \
-        strip_breathe(rgb, DELAY_MS, STEP_SIZE)
+        strip_breathe(in, rgb, DELAY_MS, STEP_SIZE)
 
 /* PATCH_ANIMATION_BREATHE_RAND
  * -------------------------------------
@@ -252,7 +297,7 @@
  *      to be similar.
  *      Supported on non-addressable strips.
  */
-#define PATCH_ANIMATION_BREATHE_RAND(DELAY_MS, STEP_SIZE) strip_breathe_random(DELAY_MS, STEP_SIZE)
+#define PATCH_ANIMATION_BREATHE_RAND(DELAY_MS, STEP_SIZE) strip_breathe_random(in, DELAY_MS, STEP_SIZE)
 
 /* PATCH_ANIMATION_BREATHE_RAINBOW
  * ----------------------------------------
@@ -266,7 +311,7 @@
  * Description:
  *      Gradiently "Breathes" trough the rgb spectrum.
  */
-#define PATCH_ANIMATION_BREATHE_RAINBOW(DELAY_MS, BREATH_STEP_SIZE, RGB_STEP_SIZE) strip_breathe_rainbow(DELAY_MS, BREATH_STEP_SIZE, RGB_STEP_SIZE)
+#define PATCH_ANIMATION_BREATHE_RAINBOW(DELAY_MS, BREATH_STEP_SIZE, RGB_STEP_SIZE) strip_breathe_rainbow(in, DELAY_MS, BREATH_STEP_SIZE, RGB_STEP_SIZE)
 
 /* PATCH_ANIMATION_BREATHE_ARR_POT_CTRL
  * ------------------------------------
@@ -284,7 +329,7 @@
         RGB_t rgb[] = { \
                 RGB_ARR \
         }; \
-        strip_breathe_array(rgb, sizeof(rgb)/sizeof(RGB_t), DELAY_MS, STEP_SIZE);
+        strip_breathe_array(in, rgb, sizeof(rgb)/sizeof(RGB_t), DELAY_MS, STEP_SIZE);
 
 /* --------------------------------
  * Potentiometer Controllable
@@ -297,7 +342,7 @@
  *      The step size, and thus speed, can be altered by the potentiometer.
  *      Supported on non-addressable strips.
  */
-#define PATCH_ANIMATION_RAINBOW_POT_CTRL strip_rainbow(pot() >> 6, (255 - pot()) >> 3, 255)
+#define PATCH_ANIMATION_RAINBOW_POT_CTRL strip_rainbow(in, in->pot >> 6, (255 - in->pot) >> 3, 255)
 
 /* PATCH_ANIMATION_SWAP_POT_CTRL
  * -----------------------------
@@ -315,7 +360,7 @@
  */
 #define PATCH_ANIMATION_SWAP_POT_CTRL(RFH, GFH, BFH, RSH, GSH, BSH) \
         static bool swap = false; \
-        if (ms_passed() >= (uint16_t)(1020 - (pot() << 2) + 100)) { \
+        if (timer_elapsed(TMR_ANIM, in->ms) >= (uint16_t)(1020 - (in->pot << 2) + 100)) { \
                 if (swap) { \
                         RGB_t rgb[] = { \
                                 {RFH, GFH, BFH}, {RSH, GSH, BSH} \
@@ -328,7 +373,7 @@
                         strip_distribute_rgb(rgb, sizeof(rgb)/sizeof(RGB_t)); \
                 } \
                 swap = !swap; \
-                reset_timer(); \
+                timer_reset(TMR_ANIM, in->ms); \
         }
 
 /* PATCH_ANIMATION_ROTATE_RAINBOW
@@ -339,7 +384,7 @@
  * Description:
  *      Rotates the rgb spectrum across the strip. The speed can be adjusted by the potentiometer.
  */
-#define PATCH_ANIMATION_ROTATE_RAINBOW_POT_CTRL(STEP_SIZE) strip_rotate_rainbow(STEP_SIZE, 31 - (pot() >> 3) + 5);
+#define PATCH_ANIMATION_ROTATE_RAINBOW_POT_CTRL(STEP_SIZE) strip_rotate_rainbow(in, STEP_SIZE, 31 - (in->pot >> 3) + 5);
 
 /* PATCH_ANIMATION_RAIN_POT_CTRL
  * -----------------------------
@@ -350,12 +395,15 @@
  * Description:
  *      Creates a rain effect across the strip.
  *      The "intensity" of the rain can be adjusted with the potentiometer.
- *      Note that this effect makes use of an RGB buffer and will linearly increase 
- *      memory consumption with strip size.
+ *      The potentiometer sets the max. amount of droplets from 0 to the
+ *      strip size, which is capped at PXBUF_SIZE (16 on the ATtiny config
+ *      templates), so on long strips only the low end of its range changes
+ *      the rain. Droplets are kept in a pixel buffer of PXBUF_SIZE pixels,
+ *      so memory does not grow with the strip size.
  *      Only supported on addressable strips.
  */
 #define PATCH_ANIMATION_RAIN_POT_CTRL(_R, _G, _B) \
-        uint8_t pot_read = pot(); \
+        uint8_t pot_read = in->pot; \
         RGB_t rgb; \
         rgb[R] = _R; \
         rgb[G] = _G; \
@@ -363,23 +411,23 @@
         uint8_t delay = (31 - (pot_read >> 3)); \
         if (delay > 10) \
                 delay = 10; \
-        strip_rain(rgb, (pot_read * strip_size) / 255, 255 - pot_read + 5, 510 - (pot_read << 1) + 5, delay);
+        strip_rain(in, rgb, (uint16_t) (((uint32_t) pot_read * strip_size) / 255), 255 - pot_read + 5, 510 - (pot_read << 1) + 5, delay);
 
 #define PATCH_ANIMATION_OVERRIDE_ARR_POT_CTRL(RGB_ARR) \
         RGB_t rgb[] = { \
                 RGB_ARR \
         }; \
-        strip_override_array(rgb, sizeof(rgb)/sizeof(RGB_t), 255 - pot() + 5);
+        strip_override_array(in, rgb, sizeof(rgb)/sizeof(RGB_t), 255 - in->pot + 5);
 
 #define PATCH_ANIMATION_OVERRIDE_RAND_POT_CTRL \
         static RGB_t rgb = {255, 255, 255}; \
-        if (strip_override(rgb, 255 - pot())) { \
+        if (strip_override(in, rgb, 255 - in->pot)) { \
                 rgb[R] = rand() % 256; \
                 rgb[G] = rand() % 256; \
                 rgb[B] = rand() % 256; \
         }
 
-#define PATCH_ANIMATION_OVERRIDE_RAINBOW_POT_CTRL(STEP_SIZE) strip_override_rainbow(255 - pot(), STEP_SIZE);
+#define PATCH_ANIMATION_OVERRIDE_RAINBOW_POT_CTRL(STEP_SIZE) strip_override_rainbow(in, 255 - in->pot, STEP_SIZE);
 
 /* --------------------------------
  * CV Controllable
@@ -388,7 +436,7 @@
 #define PATCH_ANIMATION_SWAP_ON_RISE(RFH, GFH, BFH, RSH, GSH, BSH, TRIGGER) \
         static bool prev_trigger = false; \
         static bool swap = false; \
-        bool trigger = (cv() >= TRIGGER); \
+        bool trigger = (in->cv >= TRIGGER); \
         if (!prev_trigger && trigger) \
                 swap = !swap; \
         if (swap) { \
@@ -405,19 +453,20 @@
         prev_trigger = trigger;
 
 #define PATCH_ANIMATION_MOVE_DIV_ON_RISE(_R, _G, _B, DIV_SIZE, TRIGGER) \
-        static int remaining = strip_size - DIV_SIZE; \
+        static int32_t remaining = (int32_t) strip_size - DIV_SIZE; \
         static bool prev_trigger = false; \
+        static substrp substrps[3]; \
         static substrpbuf buf = {3, NULL}; \
         if (!buf.substrps) { \
-                buf.substrps = (substrp *) malloc(sizeof(substrp) * 3); \
+                buf.substrps = substrps; \
                 buf.substrps[0].length = 0; \
                 buf.substrps[0].rgb[R] = 0; \
                 buf.substrps[0].rgb[G] = 0; \
                 buf.substrps[0].rgb[B] = 0; \
                 buf.substrps[1].length = DIV_SIZE; \
-                buf.substrps[1].rgb[R] = _R; \
-                buf.substrps[1].rgb[G] = _G; \
-                buf.substrps[1].rgb[B] = _B; \
+                buf.substrps[1].rgb[R] = COLOR8(_R); \
+                buf.substrps[1].rgb[G] = COLOR8(_G); \
+                buf.substrps[1].rgb[B] = COLOR8(_B); \
                 buf.substrps[2].length = (uint16_t) remaining; \
                 buf.substrps[2].rgb[R] = 0; \
                 buf.substrps[2].rgb[G] = 0; \
@@ -425,12 +474,12 @@
         } \
         if (remaining <= -DIV_SIZE) { \
                 Serial.println(remaining); \
-                remaining = strip_size - DIV_SIZE; \
+                remaining = (int32_t) strip_size - DIV_SIZE; \
                 buf.substrps[0].length = 0; \
                 buf.substrps[2].length = (uint16_t) remaining; \
         } \
         strip_apply_substrpbuf(buf); \
-        bool trigger = (cv() >= TRIGGER); \
+        bool trigger = (in->cv >= TRIGGER); \
         if (!prev_trigger && trigger) { \
                 buf.substrps[0].length += DIV_SIZE; \
                 remaining -= DIV_SIZE; \
@@ -442,14 +491,14 @@
         static bool prev_trigger = false; \
         static bool fade = true; \
         static RGB_t rgb = {_R, _G, _B}; \
-        bool trigger = (cv() >= TRIGGER); \
-        uint8_t steps = pot(); \
+        bool trigger = (in->cv >= TRIGGER); \
+        uint8_t steps = in->pot; \
         if (!steps) \
                 steps = 1; \
         if (!prev_trigger && trigger) { \
-                fade = strip_fade(rgb, 1, steps, true); \
+                fade = strip_fade(in, rgb, 1, steps, true); \
         } else if (!fade) { \
-                fade = strip_fade(rgb, 1, steps, false); \
+                fade = strip_fade(in, rgb, 1, steps, false); \
         } \
         prev_trigger = trigger;
 
@@ -21,17 +21,157 @@
 
 #include <stdlib.h>
 #include <string.h>
-#include <math.h>
 
 #include <avr/io.h>
 #include <avr/eeprom.h>
 #include <util/delay.h>
+#include <util/crc16.h>
 
+#include "color.h"
 #include "input.h"
 #include "ws2812.h"
 #include "strip.h"
 #include "time.h"
 
+static uint16_t out_brightness = 0xFFFF; // Master brightness of the output stage (0 - 65535)
+static uint8_t out_scale = 255;          // Master brightness rounded to 8 bits
+
+/* out_set
+ * -------
+ * Parameters:
+ *      brightness - Master brightness (0 = 0%, 65535 = 100%)
+ * Description:
+ *      Sets the master brightness of the output stage. Dithering
+ *      scales by the full 16 bits, otherwise the brightness is
+ *      rounded to 8 bits (out_scale) once rather than per pixel.
+ */
+static inline void out_set(uint16_t brightness)
+{
+        out_brightness = brightness;
+        out_scale = round8(brightness);
+}
+
+#ifdef TEMPORAL_DITHERING
+
+static uint8_t out_dither = 0;       // Rounding offset of the current frame
+
+/* dither_next
+ * -----------
+ * Description:
+ *      Advances the rounding offset of the output stage, once per
+ *      frame. Adding 157 (~256 / golden ratio) visits every offset
+ *      once every 256 frames, with consecutive offsets far apart, so
+ *      the remainder of the brightness scaling averages out quickly.
+ */
+static inline void dither_next()
+{
+        out_dither += 157;
+}
+
+#endif
+
+#if STRIP_TYPE == WS2812 && defined(POWER_LIMIT_MA) && POWER_LIMIT_MA > 0
+
+#define POWER_LIMITER
+
+#ifndef POWER_MA_PER_CHANNEL
+#define POWER_MA_PER_CHANNEL 20
+#endif
+
+// Current budget in units of the frame load (see power_run)
+// times the gamma corrected brightness (0 - 255)
+#define POWER_BUDGET ((uint32_t) POWER_LIMIT_MA * 65025 / POWER_MA_PER_CHANNEL)
+
+static uint16_t out_requested = 0xFFFF; // Brightness set by strip_set_brightness, before limiting
+static uint32_t power_load;          // Load of the frame currently being described
+static uint32_t power_gen_load;      // Load of the generated pixels of the current transmission
+static uint16_t power_gen_px;        // Pixels generated while power_gen_load was measured
+
+// Generated frames are only measured while they are sent, so their
+// brightness is limited by the load of the previous frame of the same
+// generator, kept per zone (index zone_cur). A new generator starts
+// from the worst case of a fully lit strip.
+typedef struct power_gen {
+        pxgen_t gen;                 // Generator last measured, NULL if none
+        uint32_t load;               // Load of its last frame, see power_run
+} power_gen;
+
+#ifdef ZONES
+static power_gen power_gens[NUM_ZONES + 1];
+#else
+static power_gen power_gens[1];
+#endif
+
+/* power_px
+ * --------
+ * Parameters:
+ *      rgb - RGB value of a pixel
+ * Returns:
+ *      Load of the pixel, the sum of its gamma corrected channel values
+ */
+static inline uint16_t power_px(const uint8_t *rgb)
+{
+        return gamma8(rgb[R]) + gamma8(rgb[G]) + gamma8(rgb[B]);
+}
+
+/* power_run
+ * ---------
+ * Parameters:
+ *      rgb - RGB value of the pixel run
+ *      n - Number of pixels in the run
+ * Description:
+ *      Adds a run of n equally colored pixels to the load of the
+ *      frame. The load is the sum of all gamma corrected channel
+ *      values at full brightness, so runs are accounted in O(runs).
+ */
+static void power_run(const uint8_t *rgb, uint16_t n)
+{
+        power_load += (uint32_t) power_px(rgb) * n;
+}
+
+#ifdef COLOR_16BIT
+static void power_run(const uint16_t *rgb, uint16_t n)
+{
+        power_load += (uint32_t) (gamma8(rgb[R] >> 8) + gamma8(rgb[G] >> 8) + gamma8(rgb[B] >> 8)) * n;
+}
+#endif
+
+/* power_limit
+ * -----------
+ * Parameters:
+ *      budget - Current budget of the frame, see POWER_BUDGET
+ * Description:
+ *      Lowers the brightness of the output stage if the current of
+ *      the frame (power_load) would exceed the budget. Since the
+ *      gamma curve is a power function, the current of a frame at
+ *      brightness b is proportional to power_load * gamma8(b), and the
+ *      highest brightness that fits the budget is searched in the
+ *      gamma table.
+ */
+static void power_limit(uint32_t budget)
+{
+        uint32_t max;
+        uint8_t b = 0;
+
+        if (power_load == 0)
+                return;
+
+        max = budget / power_load;
+
+        if (max >= gamma8(out_scale))
+                return;
+
+        // Largest brightness with gamma8(b) <= max
+        for (uint8_t bit = 0x80; bit; bit >>= 1) {
+                if (gamma8(b | bit) <= max)
+                        b |= bit;
+        }
+
+        out_set((uint16_t) b * 257);
+}
+
+#endif
+
 #if STRIP_TYPE == WS2812
 
 const RGB_t off = {0, 0, 0};
@@ -39,13 +179,191 @@ const RGB_t off = {0, 0, 0};
 uint16_t eeprom_strip_size EEMEM = 0;
 uint16_t strip_size;
 
+// Frame signatures
+
+static uint16_t frame_sig;           // Signature of the frame currently being described
+static bool frame_signed;            // False if the frame currently being described can't be signed
+static uint16_t tx_sig;              // Signature of the last transmitted frame
+static bool tx_sig_valid = false;    // False until the first frame has been transmitted
+static bool tx_skipped = false;      // Last frame matched the previous one and was not sent
+static uint16_t frame_strip_size = 0; // Physical size of the strip while a frame is described, 0 otherwise
+
+#ifdef ZONES
+static uint8_t zone_cur = 0;         // Zone currently being described (index + 1), 0 outside of zones
+#endif
+
+/* frame_sig_begin
+ * ---------------
+ * Description:
+ *      Starts the signature of a new frame.
+ */
+static void frame_sig_begin()
+{
+#ifdef POWER_LIMITER
+        out_set(out_requested);
+        power_load = 0;
+#endif
+
+        frame_signed = true;
+        frame_sig = 0xFFFF;
+        frame_sig = _crc16_update(frame_sig, out_brightness & 0xFF);
+        frame_sig = _crc16_update(frame_sig, out_brightness >> 8);
+}
+/* frame_sig_run
+ * -------------
+ * Parameters:
+ *      rgb - RGB value of the pixel run
+ *      n - Number of pixels in the run
+ * Description:
+ *      Adds a run of n equally colored pixels to the frame signature.
+ *      Runs are hashed by value and length, so run length encoded
+ *      frames are signed in O(runs) rather than O(pixels).
+ *      With POWER_LIMIT_MA set, the run is also added to the
+ *      load of the frame (see power_run).
+ */
+static void frame_sig_run(const uint8_t *rgb, uint16_t n)
+{
+#ifdef POWER_LIMITER
+        power_run(rgb, n);
+#endif
+
+        frame_sig = _crc16_update(frame_sig, rgb[R]);
+        frame_sig = _crc16_update(frame_sig, rgb[G]);
+        frame_sig = _crc16_update(frame_sig, rgb[B]);
+        frame_sig = _crc16_update(frame_sig, n & 0xFF);
+        frame_sig = _crc16_update(frame_sig, n >> 8);
+}
+
+#ifdef COLOR_16BIT
+static void frame_sig_run(const uint16_t *rgb, uint16_t n)
+{
+#ifdef POWER_LIMITER
+        power_run(rgb, n);
+#endif
+
+        for (uint8_t i = 0; i < 3; i++) {
+                frame_sig = _crc16_update(frame_sig, rgb[i] & 0xFF);
+                frame_sig = _crc16_update(frame_sig, rgb[i] >> 8);
+        }
+        frame_sig = _crc16_update(frame_sig, n & 0xFF);
+        frame_sig = _crc16_update(frame_sig, n >> 8);
+}
+#endif
+
+/* frame_sig_px
+ * ------------
+ * Parameters:
+ *      rgb - Color of the pixel
+ *      pos - Position of the pixel
+ * Description:
+ *      Adds a single pixel at any position to the frame signature,
+ *      e.g. of a pixel buffer. The position is only signed, with
+ *      POWER_LIMIT_MA set, the pixel adds the load of one pixel.
+ */
+static void frame_sig_px(const color_t *rgb, uint16_t pos)
+{
+#ifdef POWER_LIMITER
+        power_run(rgb, 1);
+#endif
+
+        for (uint8_t i = 0; i < 3; i++) {
+                for (uint8_t b = 0; b < sizeof(color_t); b++)
+                        frame_sig = _crc16_update(frame_sig, (uint8_t) (rgb[i] >> (b * 8)));
+        }
+        frame_sig = _crc16_update(frame_sig, pos & 0xFF);
+        frame_sig = _crc16_update(frame_sig, pos >> 8);
+}
+
+/* frame_sig_end
+ * -------------
+ * Description:
+ *      Completes the description of a frame. With POWER_LIMIT_MA
+ *      set, the brightness of the frame is limited to the budget
+ *      of the strip, or the share of the current zone or logical
+ *      strip (see map_size). Dithered
+ *      frames differ from one another even if their content doesn't
+ *      and are therefore left unsigned.
+ */
+static void frame_sig_end()
+{
+#ifdef POWER_LIMITER
+        // Zones and mapped frames may draw the share of the budget
+        // that matches their logical length
+        if (frame_strip_size)
+                power_limit(POWER_BUDGET / frame_strip_size * strip_size);
+        else
+                power_limit(POWER_BUDGET);
+#endif
+
+#ifdef TEMPORAL_DITHERING
+        if (out_brightness != 0 && out_brightness != 0xFFFF)
+                frame_signed = false;
+#endif
+}
+
+/* frame_sig_dirty
+ * ---------------
+ * Returns:
+ *      true - The frame differs from the last transmitted frame
+ *      false - The frame is identical and does not need to be sent
+ * Description:
+ *      Compares the frame signature to the signature of the last
+ *      transmitted frame. Every transmission must pass trough this
+ *      function, including partial ones, so that the stored signature
+ *      always reflects what the strip displays. Unsigned frames
+ *      are always sent.
+ */
+static bool frame_sig_dirty()
+{
+        if (!frame_signed) {
+                tx_sig_valid = false;
+                tx_skipped = false;
+                return true;
+        }
+
+        tx_skipped = tx_sig_valid && frame_sig == tx_sig;
+        tx_sig = frame_sig;
+        tx_sig_valid = true;
+        return !tx_skipped;
+}
+
+/* frame_sig_invalidate
+ * --------------------
+ * Description:
+ *      Marks the frame currently being described as unsigned,
+ *      for frames that cannot be signed before they are sent.
+ *      The frame is then transmitted regardless of its signature.
+ */
+static void frame_sig_invalidate()
+{
+        frame_signed = false;
+}
+
+/* strip_tx_skipped
+ * ----------------
+ * Returns:
+ *      true - The last frame was identical to the one before and has not been sent
+ *      false - The last frame has been sent to the strip
+ * Description:
+ *      Allows the main loop to idle if the strip content has not changed.
+ */
+bool strip_tx_skipped()
+{
+        return tx_skipped;
+}
+
 /* strip_calibrate
  * -------
  * Description:
  *      Places the controller into calibration mode to determine 
  *      the length of the LED strip. The length is specified
- *      by rotating the potentiometer (coarse) or pressing the push button (fine)
- *      until the endpoint, indicated in green, reaches the end of the strip.
+ *      by rotating the potentiometer until the endpoint, indicated
+ *      in green, reaches the end of the strip. Calibration starts
+ *      in fine zoom, where the potentiometer moves the endpoint
+ *      pixel by pixel within a window of 256 pixels. Pressing the
+ *      push button toggles coarse zoom, where the potentiometer moves
+ *      the window in steps of 256 pixels, so that the entire 16-bit
+ *      strip size range can be reached.
  *      The currently specified length is then saved/applied by holding
  *      the push button for more than a second. This function is
  *      executed after the first flash (see platformio.ini on how to flash a 
@@ -54,80 +372,140 @@ uint16_t strip_size;
  */
 void strip_calibrate()
 {
+        strip_set_brightness(255);
+
+        substrp substrps[3];
         substrpbuf buf;
         buf.n_substrps = 3;
-        buf.substrps = (substrp *)malloc(sizeof(substrp) * 3);
+        buf.substrps = substrps;
 
         buf.substrps[0].length = 0;
-        buf.substrps[0].rgb[R] = 255;
-        buf.substrps[0].rgb[G] = 255;
-        buf.substrps[0].rgb[B] = 255;
+        buf.substrps[0].rgb[R] = COLOR8(255);
+        buf.substrps[0].rgb[G] = COLOR8(255);
+        buf.substrps[0].rgb[B] = COLOR8(255);
         
         // End point
         buf.substrps[1].length = 1;
         buf.substrps[1].rgb[R] = 0;
-        buf.substrps[1].rgb[G] = 255;
+        buf.substrps[1].rgb[G] = COLOR8(255);
         buf.substrps[1].rgb[B] = 0;
 
-        buf.substrps[2].length = 255;
+        // Clears pixels behind the end point, up to the furthest
+        // pixel that has been lit since calibration has started
+        uint16_t reach = (strip_size > 255) ? strip_size : 255;
+
+        buf.substrps[2].length = reach;
         buf.substrps[2].rgb[R] = 0;
         buf.substrps[2].rgb[G] = 0;
         buf.substrps[2].rgb[B] = 0;
 
         strip_apply_substrpbuf(buf);
 
-        while (BTN_STATE);
+        // Discard events of the hold that started calibration
+        btn_flush();
 
-        bool prev_btn_state = BTN_STATE;
+        bool coarse = false;
 
-        uint8_t pot = pot_avg(255);
+        uint8_t pot = pot_smooth();
         uint8_t prev_pot = pot;
 
         while(true) {
-                bool btn_state = BTN_STATE;
-
-                if (!prev_btn_state && btn_state) { // Button press
-#if defined(BTN_DEBOUNCE_TIME) && BTN_DEBOUNCE_TIME > 0
-                        DELAY_MS(BTN_DEBOUNCE_TIME);
-#endif
-                        reset_timer();
-                } else if (btn_state) {
-                        if (ms_passed() >= 1000) { // Button held for 1 sec 
-                                strip_size = buf.substrps[0].length + 1;
-                                SET_STRIP_SIZE(strip_size);
-                                
-                                // Blink strip
-                                for (uint8_t i = 0; i < 3; i++) {
-                                        strip_apply_all((RGB_ptr_t) off);
-                                        DELAY_MS(200);
-                                        strip_apply_substrpbuf(buf);
-                                        DELAY_MS(200);
-                                }
+                uint8_t evt = btn_event();
+
+                if (evt == BTN_LONG_PRESS) { // Button held for BTN_LONG_PRESS_TIME (1 sec by default)
+                        strip_size = buf.substrps[0].length + 1;
+                        SET_STRIP_SIZE(strip_size);
+                        
+                        // Blink strip
+                        for (uint8_t i = 0; i < 3; i++) {
                                 strip_apply_all((RGB_ptr_t) off);
                                 DELAY_MS(200);
-
-                                return;
+                                strip_apply_substrpbuf(buf);
+                                DELAY_MS(200);
                         }
-                        continue;
-                } else if (prev_btn_state && !btn_state) { // Button Released
-                        buf.substrps[0].length++;
-                        buf.substrps[2].length--;
+                        strip_apply_all((RGB_ptr_t) off);
+                        DELAY_MS(200);
+
+                        btn_flush();
+                        return;
+                } else if (evt == BTN_CLICK) {
+                        coarse = !coarse;
                 }
 
-                pot = pot_avg(255);
+                pot = pot_smooth();
 
                 // Pot has been moved
                 if (pot != prev_pot) {
-                        buf.substrps[0].length = pot;
-                        buf.substrps[2].length = 254 - pot;
+                        uint16_t len = buf.substrps[0].length;
+
+                        // Coarse zoom sets the upper, fine zoom the lower byte
+                        if (coarse)
+                                len = ((uint16_t) pot << 8) | (len & 0xFF);
+                        else
+                                len = (len & 0xFF00) | pot;
+
+                        // Keep strip_size (len + 1) within 16 bits
+                        if (len == 0xFFFF)
+                                len--;
+
+                        if (len > reach)
+                                reach = len;
+
+                        buf.substrps[0].length = len;
+                        buf.substrps[2].length = reach - len;
                 }
                 
                 strip_apply_substrpbuf(buf);
-                prev_btn_state = btn_state;
                 prev_pot = pot;
         }
 }
 
+// Frame arena
+
+#ifndef FRAME_ARENA_SIZE
+#define FRAME_ARENA_SIZE 64
+#endif
+
+static uint8_t arena[FRAME_ARENA_SIZE];
+static uint16_t arena_top = 0;
+
+/* strip_arena_alloc
+ * -----------------
+ * Parameters:
+ *      size - Number of bytes to be allocated
+ * Returns:
+ *      Pointer to the allocated memory, NULL if the arena is exhausted
+ * Description:
+ *      Allocates memory from the frame arena, a static buffer of
+ *      FRAME_ARENA_SIZE bytes. Allocations are valid until the arena
+ *      is reset at the start of the next frame (see strip_arena_reset)
+ *      and are never freed individually. The firmware does not use
+ *      the heap, so memory can't fragment over time.
+ */
+void *strip_arena_alloc(uint16_t size)
+{
+        void *ret;
+
+        if (size > FRAME_ARENA_SIZE - arena_top)
+                return NULL;
+
+        ret = &arena[arena_top];
+        arena_top += size;
+
+        return ret;
+}
+
+/* strip_arena_reset
+ * -----------------
+ * Description:
+ *      Releases all allocations of the frame arena.
+ *      Called by update_strip() before every patch.
+ */
+void strip_arena_reset()
+{
+        arena_top = 0;
+}
+
 /* zero_RGBbuf
  * -------
  * Parameters:
@@ -146,14 +524,18 @@ void zero_RGBbuf(RGBbuf buf, uint16_t size)
  * Parameters:
  *      size - Size of RGB buffer
  * Returns:
- *      Pointer to a newly allocated RGB buffer
+ *      Pointer to a new RGB buffer, NULL if the frame arena is exhausted
  * Description:
- *      Allocates a new RGB buffer.
+ *      Allocates a new RGB buffer from the frame arena
+ *      (see strip_arena_alloc).
  */
 RGBbuf init_RGBbuf(uint16_t size)
 {
-        RGBbuf ret = (RGBbuf)malloc(size * sizeof(RGB_t));
-        zero_RGBbuf(ret, size);
+        RGBbuf ret = (RGBbuf)strip_arena_alloc(size * sizeof(RGB_t));
+
+        if (ret)
+                zero_RGBbuf(ret, size);
+
         return ret;
 }
 
@@ -175,6 +557,78 @@ void rgb_cpy(RGB_ptr_t dst, RGB_t src)
         dst[B] = src[B];
 }
 
+/* color_set
+ * ---------
+ * Parameters:
+ *      dst - Destination color (see color_t)
+ *      rgb - Source RGB object
+ * Description:
+ *      Converts an 8-bit RGB object into the working precision.
+ */
+static inline void color_set(color_t *dst, const uint8_t *rgb)
+{
+        dst[R] = COLOR8(rgb[R]);
+        dst[G] = COLOR8(rgb[G]);
+        dst[B] = COLOR8(rgb[B]);
+}
+
+/* color_cpy
+ * ---------
+ * Parameters:
+ *      dst - Destination color
+ *      src - Source color
+ * Description:
+ *      Copies a color of the working precision.
+ */
+static inline void color_cpy(color_t *dst, const color_t *src)
+{
+        dst[R] = src[R];
+        dst[G] = src[G];
+        dst[B] = src[B];
+}
+
+/* color_get
+ * ---------
+ * Parameters:
+ *      dst - Destination RGB object
+ *      src - Source color of the working precision
+ * Description:
+ *      Rounds a color of the working precision to 8 bits.
+ */
+static inline void color_get(RGB_ptr_t dst, const color_t *src)
+{
+#ifdef COLOR_16BIT
+        for (uint8_t i = 0; i < 3; i++)
+                dst[i] = (src[i] - (src[i] >> 8) + 128) >> 8; // src / 257, rounded
+#else
+        color_cpy(dst, src);
+#endif
+}
+
+/* color_apply_brightness
+ * ----------------------
+ * Parameters:
+ *      rgb - Color of the working precision
+ *      brightness - Brightness to be applied (0 = 0%, 255 = 100%)
+ * Description:
+ *      Same as rgb_apply_brightness, for colors stored in substrip
+ *      and pixel buffers. With COLOR_16BIT set, the result keeps
+ *      the fraction that 8-bit channels would lose.
+ */
+static void color_apply_brightness(color_t *rgb, uint8_t brightness)
+{
+#ifdef COLOR_16BIT
+        brightness = cie8(brightness);
+
+        for (uint8_t i = 0; i < 3; i++) {
+                uint32_t x = (uint32_t) rgb[i] * brightness + 128;
+                rgb[i] = (x + (x >> 8)) >> 8; // x / 255, rounded
+        }
+#else
+        rgb_apply_brightness(rgb, brightness);
+#endif
+}
+
 /* rgb_apply_brightness
  * --------------------
  * Parameters:
@@ -182,15 +636,12 @@ void rgb_cpy(RGB_ptr_t dst, RGB_t src)
  *      brightness - Brightness to be applied to the RGB object
  * Description:
  *      Applies a brightness (0 = 0%, 255 = 100%) to the provided
- *      RGB object.
+ *      RGB object. With PERCEPTUAL_BRIGHTNESS set, the brightness
+ *      is mapped trough the CIE lightness curve (see cie8).
  */
 void rgb_apply_brightness(RGB_ptr_t rgb, uint8_t brightness)
 {
-        if (brightness < 255) {
-                rgb[R] = round(((double)brightness/255) * (double)rgb[R]);
-                rgb[G] = round(((double)brightness/255) * (double)rgb[G]);
-                rgb[B] = round(((double)brightness/255) * (double)rgb[B]);
-        }
+        scale8_buf(rgb, 3, cie8(brightness));
 }
 
 /* substripbuf_apply_brightness
@@ -206,234 +657,558 @@ void substripbuf_apply_brightness(substrpbuf *substrpbuf, uint8_t brightness)
 {
         if (brightness < 255) {
                 for (uint16_t i = 0; i < substrpbuf->n_substrps; i++) 
-                        rgb_apply_brightness(substrpbuf->substrps[i].rgb, brightness);
+                        color_apply_brightness(substrpbuf->substrps[i].rgb, brightness);
         }
 }
 
-/* rgb_apply_fade
- * --------------
+// Output stage
+
+/* strip_set_brightness
+ * --------------------
  * Parameters:
- *      rgb - RGB object to store fade values
- *      step_size - Color steps after each call
+ *      brightness - Master brightness (0 = 0%, 255 = 100%)
  * Description:
- *      Apples rgb fading to the provided rgb object.
+ *      Sets the master brightness of the output stage. The brightness
+ *      is applied when the frame is sent to the strip, so patches
+ *      can hand over unscaled colors without creating copies.
+ *      update_strip() resets the brightness to 100% before every patch.
+ *      With PERCEPTUAL_BRIGHTNESS set, the brightness is mapped trough
+ *      the CIE lightness curve (see cie16).
  */
-void rgb_apply_fade(RGB_ptr_t rgb, uint8_t step_size)
+void strip_set_brightness(uint8_t brightness)
 {
-        bool r2g;
-
-        // Invalid RGB, correct it!
-        if (rgb[R] != 0 && rgb[G] != 0 && rgb[B] != 0) {
-                rgb[R] = 255;
-                rgb[G] = 0;
-                rgb[B] = 0;
-        }        
-
-        r2g = (rgb[G] < 255 && rgb[B] == 0);
-
-        uint8_t tmp;
-
-        if (step_size == 0)
-                step_size = 1;
-
-        if (r2g) {
-                tmp = rgb[R];
-                tmp -= step_size;
-
-                if (tmp > rgb[R]) {
-                        rgb[R] = 0;
-                        rgb[G] = tmp;
-                        rgb[B] = 255 - tmp;
-                } else {
-                        rgb[R] = tmp;
-                        rgb[G] += step_size;
-                }
-        } else if (rgb[G] > 0) {
-                tmp = rgb[G];
-                tmp -= step_size;
-
-                if (tmp > rgb[G]) {
-                        rgb[G] = 0;
-                        rgb[B] = tmp;
-                        rgb[R] = 255 - tmp;
-                } else {
-                        rgb[G] = tmp;
-                        rgb[B] += step_size;
-                }
-        } else {
-                tmp = rgb[B];
-                tmp -= step_size;
+        out_set(cie16(brightness));
+#ifdef POWER_LIMITER
+        out_requested = out_brightness;
+#endif
+}
 
-                if (tmp > rgb[B]) {
-                        rgb[B] = 0;
-                        rgb[R] = tmp;
-                        rgb[G] = 255 - tmp;
-                } else {
-                        rgb[B] = tmp;
-                        rgb[R] += step_size;
-                }
+/* out_acc_t
+ * ---------
+ * Description:
+ *      Product of a channel value and the master brightness,
+ *      8x8 bit or, with TEMPORAL_DITHERING set, 8x16 bit.
+ */
+#ifdef TEMPORAL_DITHERING
+typedef uint32_t out_acc_t;
+#else
+typedef uint16_t out_acc_t;
+#endif
 
-        }
+/* out_factor
+ * ----------
+ * Returns:
+ *      The master brightness channel values are multiplied by
+ */
+static inline out_acc_t out_factor()
+{
+#ifdef TEMPORAL_DITHERING
+        return out_brightness;
+#else
+        return out_scale;
+#endif
 }
 
-#if STRIP_TYPE == WS2812
-
-/* substripbuf_cpy
- * ---------------
+/* out_channel
+ * -----------
  * Parameters:
- *      dst - Strip object to store copy
- *      src - Strip object to be copied
+ *      x - Channel value times out_factor()
+ * Returns:
+ *      The output value of the channel
  * Description:
- *      Creates a deep copy of a substrip object.
+ *      Rounds the product of a channel and the master brightness
+ *      like scale8 (or scale8_dither with the offset of the current
+ *      frame) and gamma corrects it. Products can be summed up
+ *      ahead of time, so a channel that changes by a fixed step
+ *      is passed trough the output stage without a multiplication
+ *      (see rainbow_next).
  */
-void substripbuf_cpy(substrpbuf *dst, substrpbuf *src)
+static inline uint8_t out_channel(out_acc_t x)
 {
-        dst->substrps = (substrp *)malloc(sizeof(substrp) * src->n_substrps);
-        dst->n_substrps = src->n_substrps;
-        memcpy(dst->substrps, src->substrps, sizeof(substrp) * dst->n_substrps);
+#ifdef TEMPORAL_DITHERING
+        // Rescale to x / 65535 in 8.16 fixed point
+        x += (x >> 16) + 1;
+        return gamma8((x + ((uint16_t) out_dither << 8)) >> 16);
+#else
+        x += 127;
+        return gamma8((x + 1 + (x >> 8)) >> 8);
+#endif
 }
 
-/* substrpbuf_free
- * ---------------
- * Parameters:
- *      substrpbuf - Pointer to the substrip buffer to be freed
- * Description:
- *      Frees a substrip buffer.
+/* out_identity
+ * ------------
+ * Returns:
+ *      true - The output stage leaves colors unchanged, that is
+ *             at full brightness without gamma correction
+ *      false - Colors must be passed trough the output stage
  */
-void substrpbuf_free(substrpbuf *substrpbuf)
+static inline bool out_identity()
 {
-        free(substrpbuf->substrps);
+#ifdef GAMMA_CORRECTION
+        return false;
+#else
+        return out_brightness == 0xFFFF;
+#endif
 }
 
-/* pxbuf_init
- * ----------
+/* output_px
+ * ---------
  * Parameters:
- *      buf - Pointer to a pixel buffer
+ *      dst - RGB object to store the output value
+ *      src - Source RGB value
  * Description:
- *      Initializes a pixel buffer.
+ *      Passes a source color trough the output stage, that is
+ *      the master brightness followed by the gamma correction
+ *      (see gamma8), if enabled. With TEMPORAL_DITHERING set,
+ *      the channels are scaled by the 16-bit brightness and their
+ *      fraction is rounded with the offset of the current frame,
+ *      so that it is spread over time (see scale8_dither).
  */
-void pxbuf_init(pxbuf *buf)
+static inline void output_px(RGB_ptr_t dst, const uint8_t *src)
 {
-        buf->buf = NULL;
-        buf->size = 0;
+        dst[R] = out_channel((out_acc_t) src[R] * out_factor());
+        dst[G] = out_channel((out_acc_t) src[G] * out_factor());
+        dst[B] = out_channel((out_acc_t) src[B] * out_factor());
 }
 
-/* pxbuf_insert
- * -------------
+#ifdef COLOR_16BIT
+
+/* output16
+ * --------
  * Parameters:
- *      buf - Pointer to a pixel buffer
- *      pos - Position of the pixel to be inserted
- *      rgb - RGB value of the pixel
+ *      val - 16-bit channel value
+ * Returns:
+ *      The 8-bit output value of the channel
  * Description:
- *      Adds/Allocates a pixel in the pixel buffer.
+ *      Applies the master brightness to a 16-bit channel and
+ *      rounds the result to 8 bits. Only this final step drops
+ *      the fraction of the channel, which is otherwise carried
+ *      trough every operation on the buffer. With TEMPORAL_DITHERING
+ *      set, the fraction is dithered rather than rounded.
  */
-void pxbuf_insert(pxbuf *buf, uint16_t pos, RGB_t rgb)
+static inline uint8_t output16(uint16_t val)
 {
-        if (buf->size == 0) {
-                buf->buf = (pxl *)malloc(sizeof(pxl));
-                buf->buf[0].pos = pos;
-                rgb_cpy(buf->buf[0].rgb, rgb);
-                buf->size++;
-                return;
-        }
+        uint32_t hi = (uint32_t) (val >> 8) * out_brightness;
+        uint32_t lo = (uint32_t) (uint8_t) val * out_brightness;
 
-        for (uint16_t i = 0; i < buf->size; i++) {
+        // val * out_brightness / 257, from the high and the low byte of
+        // val. Colors assigned trough COLOR8 (v * 257) have equal bytes
+        // and scale exactly like v in the 8-bit output stage.
+        uint32_t x = hi - (hi >> 8) + (lo >> 8);
 
-                // Pixel already allocated
-                if (buf->buf[i].pos == pos) {
-                        rgb_cpy(buf->buf[i].rgb, rgb);
-                        return;
-                }
+        // Rescale to x / 65535 in 8.16 fixed point
+        x += (x >> 16) + 1;
+
+#ifdef TEMPORAL_DITHERING
+        return (x + ((uint16_t) out_dither << 8)) >> 16;
+#else
+        return (x + 0x8000) >> 16;
+#endif
+}
 
-                // Not the last pixel in the pxbuf, insert and shift array!
-                if (buf->buf[i].pos > pos) {
-                        buf->size++;
-                        buf->buf = (pxl *)realloc(buf->buf, sizeof(pxl) * buf->size);
+/* output_px
+ * ---------
+ * Parameters:
+ *      dst - RGB object to store the output value
+ *      src - Source color with 16-bit channels
+ * Description:
+ *      Output stage for 16-bit colors, see output_px above.
+ */
+static inline void output_px(RGB_ptr_t dst, const uint16_t *src)
+{
+        dst[R] = gamma8(output16(src[R]));
+        dst[G] = gamma8(output16(src[G]));
+        dst[B] = gamma8(output16(src[B]));
+}
 
-                        for (uint16_t j = buf->size-1; j > i; j--) {
-                                pxl* prev_px = &(buf->buf[j-1]);
-                                buf->buf[j].pos = prev_px->pos;
-                                rgb_cpy(buf->buf[j].rgb, prev_px->rgb);
-                        }
+#endif
 
-                        buf->buf[i].pos = pos;
-                        rgb_cpy(buf->buf[i].rgb, rgb);
+#if STRIP_TYPE == WS2812
 
-                        return;
-                }
-        }
+// Time spent between kernel calls, beyond WS2812_US_PER_CALL,
+// while interrupts are disabled. Generators and the rotating
+// rainbow measure their cost per pixel before the transmission
+// (see tx_cycles_per_px), switching to the next map segment or
+// zone is estimated (not measured on hardware).
+#define STRIP_SWITCH_CYCLES 64     // Call of a transmit routine, including the search of a reversed segment
+#define STRIP_PX_SAMPLES 16        // Pixels timed to measure the cost of a pixel
+
+static uint32_t tx_stall;          // Cycles spent between kernel calls during the current transmission
+static volatile uint8_t tx_sink;   // Keeps timed pixels from being optimized out
+
+/* strip_tx_begin
+ * --------------
+ * Description:
+ *      Starts a transmission, see ws2812_prep_tx. Sources must
+ *      have been passed trough the output stage (see frame_prep_t),
+ *      only output colors are sent from here on.
+ */
+static void strip_tx_begin()
+{
+        tx_stall = 0;
+        ws2812_prep_tx();
+}
 
-        // Last pixel in the pxbuf, simply append it!
-        buf->size++;
-        buf->buf = (pxl *)realloc(buf->buf, sizeof(pxl) * buf->size);
-        buf->buf[buf->size-1].pos = pos;
-        rgb_cpy(buf->buf[buf->size-1].rgb, rgb);
+/* strip_tx_end
+ * ------------
+ * Description:
+ *      Ends a transmission, see ws2812_end_tx. The time spent
+ *      between kernel calls (tx_stall) is passed on, so that
+ *      the clock is corrected by the whole transmission.
+ */
+static void strip_tx_end()
+{
+        ws2812_end_tx(tx_stall / (F_CPU / 1000000));
 }
 
-bool pxbuf_exists(pxbuf *buf, uint16_t pos)
+/* tx_cycles_per_px
+ * ----------------
+ * Parameters:
+ *      start_us - Clock reading (clock_us) before STRIP_PX_SAMPLES
+ *                 pixels have been computed
+ * Returns:
+ *      Cycles spent per pixel, see tx_stall
+ * Description:
+ *      Measures the cost of pixels that are computed between
+ *      two kernel calls. Called before interrupts are disabled.
+ */
+static uint16_t tx_cycles_per_px(uint32_t start_us)
 {
-        for (uint16_t i = 0; i < buf->size; i++) {
-                if (buf->buf[i].pos == pos)
-                        return true;
-                else if (buf->buf[i].pos > pos)                
-                        break;
+        return (clock_us() - start_us) * (F_CPU / 1000000) / STRIP_PX_SAMPLES;
+}
+
+/* strip_tx_pxgen
+ * --------------
+ * Parameters:
+ *      gen - Pixel generator
+ *      start - Index of the first pixel to be generated
+ *      n - Number of pixels to be generated
+ *      rev - Generate the pixels in descending order
+ * Description:
+ *      Pulls n pixels from a generator and sends them as they
+ *      are generated. Only used while the output stage leaves
+ *      colors unchanged, see strip_apply_pxgen.
+ *      With POWER_LIMIT_MA set, the load of the generated
+ *      pixels is added to power_gen_load (see map_tx).
+ */
+static void strip_tx_pxgen(pxgen_t gen, uint16_t start, uint16_t n, bool rev)
+{
+        RGB_t px;
+        uint16_t i = rev ? start + n - 1 : start;
+#ifdef POWER_LIMITER
+        uint32_t load = 0;
+#endif
+
+        for (uint16_t j = 0; j < n; j++) {
+                gen(i, px);
+#ifdef POWER_LIMITER
+                load += power_px(px);
+#endif
+                ws2812_tx_run(px, 1);
+                i = rev ? i - 1 : i + 1;
         }
 
-        return false;
+#ifdef POWER_LIMITER
+        power_gen_load += load;
+        power_gen_px += n;
+#endif
 }
 
-/* pxbuf_remove
- * -------------
+// Frame submission
+//
+// Frames are described before they are sent. The strip_apply_*
+// functions sign their content and then submit a transmit routine
+// along with its source. Without zones, the routine is called right
+// away if the frame differs from the last one. With zones, the
+// routine is stored for the current zone and called when all zones
+// are sent in a single pass (see strip_frame_end).
+//
+// Patches describe the logical strip. With STRIP_MAP set, the
+// transmit routine is called once per segment of the physical
+// strip (see map_tx), so mirrored and tiled frames are only
+// described once and replayed for every copy.
+
+/* frame_src
+ * ---------
+ * Description:
+ *      Source of a submitted transmit routine, along with the
+ *      output colors prepared for it (see frame_prep_t).
+ */
+typedef struct frame_src {
+        union {
+                struct {
+                        RGB_t rgb;
+                        RGB_t out;         // Output color
+                        uint16_t n;
+                } run;                     // strip_apply_all
+                substrpbuf substrps;       // strip_apply_substrpbuf
+                struct {
+                        const uint8_t *px;
+                        uint16_t n;
+                } buf;                     // strip_apply_RGBbuf
+                pxbuf *px;                 // strip_apply_pxbuf
+                palbuf *pal;               // strip_apply_palbuf
+#ifdef COMPOSITE_PIXELS
+                const composite *comp;     // strip_apply_composite
+#endif
+                struct {
+                        pxgen_t fn;
+                        uint16_t cycles;   // Cycles per pixel, see tx_stall
+#ifdef POWER_LIMITER
+                        power_gen *pg;     // Measured load of the generator
+#endif
+                } gen;                     // strip_apply_pxgen
+                struct {
+                        hue_t hue;
+                        uint8_t step;
+                        out_acc_t inc;     // step times out_factor(), see rainbow_next
+                        uint16_t cycles;   // Cycles per pixel, see tx_stall
+#if defined(HUE_RING_SIZE) && HUE_RING_SIZE > 0
+                        uint16_t ring_pos; // Ring index of the first pixel
+                        uint16_t ring_gen; // Build of the hue ring the position refers to
+                        bool ring;         // Sent from the hue ring, see prep_rotate_rainbow
+#endif
+                } rainbow;                 // strip_rotate_rainbow
+        };
+        const uint8_t *out;                // Output colors of buffered sources, NULL if unused
+} frame_src;
+
+/* frame_tx_t
+ * ----------
  * Parameters:
- *      buf - Pointer to a pixel buffer
- *      index - Index of pixel element to be deleted
+ *      src - Source of the frame
+ *      start - Logical index of the first pixel to be sent
+ *      n - Number of pixels to be sent
+ *      rev - Send the pixels in descending order
+ * Returns:
+ *      Number of pixels sent
  * Description:
- *      Deletes the pixel object stored at the provided index (NOT POSITION!).
+ *      Transmit routine. Sends the pixels [start, start + n) of the
+ *      source. Pixel runs end at their length, pixel buffers and
+ *      generators at their size or strip_size. Sent forwards, the
+ *      pixels past the end are left out and the caller pads them.
+ *      Sent in reverse, they come first and are sent as off, so
+ *      exactly n pixels are sent. Runs while interrupts are disabled
+ *      and only sends the output colors prepared by frame_prep_t,
+ *      see pxgen_t for the cycle budget between pixels.
  */
-void pxbuf_remove(pxbuf *buf, uint16_t index)
+typedef uint16_t (*frame_tx_t)(const frame_src *src, uint16_t start, uint16_t n, bool rev);
+
+/* frame_prep_t
+ * ------------
+ * Parameters:
+ *      src - Source of the frame
+ * Returns:
+ *      true - The source is ready to be sent
+ *      false - The frame arena can't hold its output colors
+ * Description:
+ *      Passes the colors of a source trough the output stage once
+ *      the brightness of the frame is known and before interrupts
+ *      are disabled, so that no scaling is left between two pixels.
+ *      Output colors that don't fit into the source are allocated
+ *      from the frame arena and released once the frame has been
+ *      sent. Frames whose output colors don't fit are sent as off.
+ */
+typedef bool (*frame_prep_t)(frame_src *src);
+
+static uint8_t prep_round = 0;       // Incremented before the sources of a transmission are prepared
+
+/* tx_off
+ * ------
+ * Description:
+ *      Transmit routine of a frame that is sent as off.
+ */
+static uint16_t tx_off(const frame_src *src, uint16_t start, uint16_t n, bool rev)
 {
-        buf->size--;
-        
-        if (buf->size == 0) {
-                free(buf->buf);
-                buf->buf = NULL;
-                return;
+        if (!rev)
+                return 0;
+
+        ws2812_tx_run(off, n);
+        return n;
+}
+
+/* tx_len
+ * ------
+ * Parameters:
+ *      size - Number of pixels in the source
+ *      start - Logical index of the first pixel to be sent
+ *      n - Number of pixels to be sent
+ * Returns:
+ *      Number of pixels of [start, start + n) within the source
+ */
+static uint16_t tx_len(uint16_t size, uint16_t start, uint16_t n)
+{
+        if (start >= size)
+                return 0;
+
+        return (n > size - start) ? size - start : n;
+}
+
+/* map_size
+ * --------
+ * Parameters:
+ *      n - Number of physical pixels
+ * Returns:
+ *      Number of logical pixels mapped onto n physical pixels
+ */
+static uint16_t map_size(uint16_t n)
+{
+#if STRIP_MAP == MAP_MIRROR
+        return n - n / 2;
+#elif STRIP_MAP == MAP_TILE
+        return (n + STRIP_MAP_TILES - 1) / STRIP_MAP_TILES;
+#else
+        return n;
+#endif
+}
+
+/* map_tx
+ * ------
+ * Parameters:
+ *      tx - Transmit routine of the frame
+ *      src - Source of the transmit routine
+ *      n - Number of physical pixels
+ * Description:
+ *      Sends a logical frame of map_size(n) pixels onto n physical
+ *      pixels, as configured by STRIP_MAP:
+ *        MAP_REVERSE - The frame is sent in reverse
+ *        MAP_MIRROR - The frame is sent forwards, then in reverse
+ *        MAP_TILE - The frame is repeated STRIP_MAP_TILES times
+ *        MAP_SERPENTINE - The frame is cut into rows of STRIP_MAP_WIDTH
+ *                         pixels, every second row is sent in reverse
+ *      Physical pixels not covered by the frame are set to off.
+ *      Every segment calls the transmit routine again, so buffered
+ *      frames are only read again, but generators (see
+ *      strip_apply_pxgen) that stream their pixels compute every
+ *      copy anew and get no saving from MAP_MIRROR or MAP_TILE.
+ *      Every segment adds the call of a transmit routine, and for
+ *      reversed segments the search of their last pixel, to the
+ *      cycle budget between pixels (see pxgen_t) and is added to
+ *      tx_stall as STRIP_SWITCH_CYCLES.
+ *      With POWER_LIMIT_MA set, generated pixels are measured over
+ *      all segments, and their load is scaled back to the logical
+ *      frame and stored for the next frame of the generator.
+ */
+static void map_tx(frame_tx_t tx, const frame_src *src, uint16_t n)
+{
+#ifdef POWER_LIMITER
+        power_gen_load = 0;
+        power_gen_px = 0;
+#endif
+
+#if STRIP_MAP == MAP_REVERSE
+        tx_stall += STRIP_SWITCH_CYCLES;
+        tx(src, 0, n, true);
+#elif STRIP_MAP == MAP_MIRROR
+        uint16_t half = map_size(n);
+
+        tx_stall += 2 * STRIP_SWITCH_CYCLES;
+        ws2812_tx_run(off, half - tx(src, 0, half, false));
+        tx(src, 0, n / 2, true);
+#elif STRIP_MAP == MAP_TILE
+        uint16_t len = map_size(n);
+
+        for (uint16_t pos = 0; pos < n; pos += len) {
+                if (len > n - pos)
+                        len = n - pos;
+
+                tx_stall += STRIP_SWITCH_CYCLES;
+                ws2812_tx_run(off, len - tx(src, 0, len, false));
         }
+#elif STRIP_MAP == MAP_SERPENTINE
+        uint16_t len = STRIP_MAP_WIDTH;
+        bool rev = false;
 
-        for (uint16_t i = index; i < buf->size; i++) {
-                buf->buf[i] = buf->buf[i+1];               
+        for (uint16_t pos = 0; pos < n; pos += len) {
+                if (len > n - pos)
+                        len = n - pos;
+
+                tx_stall += STRIP_SWITCH_CYCLES;
+                if (rev)
+                        tx(src, pos, len, true);
+                else
+                        ws2812_tx_run(off, len - tx(src, pos, len, false));
+
+                rev = !rev;
         }
+#else
+        tx_stall += STRIP_SWITCH_CYCLES;
+        ws2812_tx_run(off, n - tx(src, 0, n, false));
+#endif
 
-        buf->buf = (pxl *)realloc(buf->buf, sizeof(pxl) * buf->size);
+#ifdef POWER_LIMITER
+        // Only generated sources measure pixels
+        if (power_gen_px == map_size(n))
+                src->gen.pg->load = power_gen_load;
+        else if (power_gen_px)
+                src->gen.pg->load = power_gen_load / power_gen_px * map_size(n);
+#endif
 }
 
-/* pxbuf_remove_at
- * ---------------
+#ifdef ZONES
+
+constexpr zone zones[] = { ZONES };
+const uint8_t num_zones = NUM_ZONES;
+
+// Frame arena memory of a zone's last frame, see frame_keep
+#define ZONE_ARENA_SIZE (FRAME_ARENA_SIZE / NUM_ZONES)
+
+static uint8_t zone_arena[NUM_ZONES][ZONE_ARENA_SIZE];
+
+/* zone_patches_unique
+ * -------------------
  * Parameters:
- *      buf - Pointer to a pixel buffer
- *      pos - Position of pixel to be deleted from the pixel buffer
+ *      i - Index of the first zone to be compared
+ *      j - Index of the second zone to be compared
  * Returns:
- *      true - Pixel object deleted
- *      false - No pixel object assigned to the position
+ *      true - No zone from i on shares its patch with a later zone
+ *      false - Two zones are rendered by the same patch
+ */
+static constexpr bool zone_patches_unique(uint8_t i, uint8_t j)
+{
+        return (i >= NUM_ZONES) ? true :
+               (j >= NUM_ZONES) ? zone_patches_unique(i + 1, i + 2) :
+               zones[i].patch != zones[j].patch && zone_patches_unique(i, j + 1);
+}
+
+// Patches keep their state in static variables, which would
+// advance once per zone if a patch was rendered by two zones
+static_assert(zone_patches_unique(0, 1), "ZONES lists a patch more than once!");
+
+/* zone_frame
+ * ----------
  * Description:
- *      Deletes the pixel object assigned to the position.
+ *      Frame submitted by the patch of a zone. Zones keep their
+ *      last frame if their patch doesn't submit a new one.
  */
-bool pxbuf_remove_at(pxbuf *buf, uint16_t pos)
+typedef struct zone_frame {
+        frame_tx_t tx;             // Transmit routine, NULL until the first submission
+        frame_prep_t prep;         // Output stage of the source, or NULL
+        frame_src src;             // Source of the transmit routine
+        uint16_t brightness;       // Output brightness of the zone
+        uint16_t sig;              // Signature of the zone's frame
+        bool sig_valid;            // False if the zone's frame is unsigned
+} zone_frame;
+
+static zone_frame zone_frames[NUM_ZONES];
+
+/* zone_patch_fixed
+ * ----------------
+ * Parameters:
+ *      patch - Index of a patch
+ * Returns:
+ *      true - The patch is rendered by a zone of its own
+ *      false - The patch is not listed in ZONES
+ * Description:
+ *      Patches listed in ZONES are skipped when the patch
+ *      of ZONE_SELECTED zones is selected, as they would
+ *      otherwise be rendered twice per frame.
+ */
+bool zone_patch_fixed(uint8_t patch)
 {
-        for (uint16_t i = 0; i < buf->size; i++)
-        {
-                if (buf->buf[i].pos == pos) {
-                        pxbuf_remove(buf, i);
+        for (uint8_t z = 0; z < NUM_ZONES; z++) {
+                if (zones[z].patch == patch)
                         return true;
-                }
-
-                // If no previous pixel has matched
-                // and we've reached a position exceeding pos,
-                // we can assume the position has no entry
-                // in the pxbuf
-                if (buf->buf[i].pos > pos) {
-                        return false;
-                }
         }
 
         return false;
@@ -441,373 +1216,2181 @@ bool pxbuf_remove_at(pxbuf *buf, uint16_t pos)
 
 #endif
 
-/* strip_apply_all
- * ---------------
+/* frame_keep
+ * ----------
  * Parameters:
- *      rgb - RGB value to be applied across the LED strip
+ *      data - Memory referenced by the source of a frame
+ *      size - Size of the memory in bytes
+ * Returns:
+ *      Memory that is valid until the next frame of the current
+ *      zone, NULL if the zone can't hold it
  * Description:
- *      Applies a RGB value across the entire LED strip.
+ *      Zones keep their last frame while their patch doesn't submit
+ *      a new one, but the frame arena is released every frame. With
+ *      ZONES set, sources allocated from the frame arena are copied
+ *      into the zone's share of FRAME_ARENA_SIZE / NUM_ZONES bytes.
+ *      Any other memory is owned by the patch and returned as is.
  */
-void strip_apply_all(RGB_ptr_t rgb)
+static const void *frame_keep(const void *data, uint16_t size)
 {
-#if STRIP_TYPE == WS2812
-        ws2812_prep_tx();
-        for (uint16_t i = 0; i < strip_size; i++) {
-                ws2812_tx_byte(rgb[WS2812_WIRING_RGB_0]);
-                ws2812_tx_byte(rgb[WS2812_WIRING_RGB_1]);
-                ws2812_tx_byte(rgb[WS2812_WIRING_RGB_2]);
-        }
-        ws2812_end_tx();
+#ifdef ZONES
+        const uint8_t *p = (const uint8_t *) data;
+
+        if (!zone_cur || p < arena || p >= arena + FRAME_ARENA_SIZE)
+                return data;
+
+        if (size > ZONE_ARENA_SIZE)
+                return NULL;
+
+        memcpy(zone_arena[zone_cur - 1], data, size);
+        return zone_arena[zone_cur - 1];
 #else
-        NON_ADDR_STRIP_R_OCR = rgb[R];
-        NON_ADDR_STRIP_G_OCR = rgb[G];
-        NON_ADDR_STRIP_B_OCR = rgb[B];
+        return data;
 #endif
 }
 
-#if STRIP_TYPE == WS2812
-
-/* strip_apply_substrpbuf
- * ----------------------
+/* frame_submit
+ * ------------
  * Parameters:
- *      substrpbuf - Sub strip buffer to be applied across the LED strip
+ *      tx - Transmit routine of the frame
+ *      src - Source of the transmit routine
+ *      prep - Output stage of the source, see frame_prep_t
  * Description:
- *      Applies a strip object across the LED strip.
+ *      Completes the description of a frame and sends it if
+ *      it differs from the last one. While zones are described,
+ *      the frame is stored for the current zone instead and
+ *      prepared when all zones are sent. Frames described outside
+ *      of strip_frame_begin and strip_frame_end, such as the
+ *      calibration frames, are sent unmapped.
  */
-void strip_apply_substrpbuf(substrpbuf substrpbuf)
+static void frame_submit(frame_tx_t tx, frame_src *src, frame_prep_t prep)
 {
-        ws2812_prep_tx();
-        for (uint16_t i = 0; i < substrpbuf.n_substrps; i++) {
-                for (uint16_t j = 0; j < substrpbuf.substrps[i].length; j++) {
-                        ws2812_tx_byte(substrpbuf.substrps[i].rgb[WS2812_WIRING_RGB_0]);
-                        ws2812_tx_byte(substrpbuf.substrps[i].rgb[WS2812_WIRING_RGB_1]);
-                        ws2812_tx_byte(substrpbuf.substrps[i].rgb[WS2812_WIRING_RGB_2]);
-                }
+        uint16_t top = arena_top;
+
+        frame_sig_end();
+
+#ifdef ZONES
+        if (zone_cur) {
+                zone_frame *zf = &zone_frames[zone_cur - 1];
+
+                zf->tx = tx;
+                zf->prep = prep;
+                zf->src = *src;
+                zf->brightness = out_brightness;
+                zf->sig = frame_sig;
+                zf->sig_valid = frame_signed;
+                return;
+        }
+#endif
+
+        if (!frame_sig_dirty())
+                return;
+
+#ifdef TEMPORAL_DITHERING
+        dither_next();
+#endif
+
+        src->out = NULL;
+        prep_round++;
+        if (!prep(src)) {
+                tx = tx_off;
+                tx_sig_valid = false;
         }
-        ws2812_end_tx();
+
+        strip_tx_begin();
+        if (frame_strip_size)
+                map_tx(tx, src, frame_strip_size);
+        else
+                tx(src, 0, UINT16_MAX, false);
+        strip_tx_end();
+
+        // Release the output colors
+        arena_top = top;
 }
 
-/* strip_apply_RGBbuf
- * ------------------
+/* strip_frame_begin
+ * -----------------
+ * Description:
+ *      Starts the description of a frame. Until strip_frame_end,
+ *      strip_size holds the logical size of the strip (see map_size).
+ *      With ZONES set, must be followed by strip_zone_begin and the
+ *      patch of every zone.
+ */
+void strip_frame_begin()
+{
+        frame_strip_size = strip_size;
+        strip_size = map_size(strip_size);
+}
+
+#ifdef ZONES
+
+/* strip_zone_begin
+ * ----------------
  * Parameters:
- *      RGBbuf - RGB buffer to be applied across the LED strip
+ *      z - Index of the zone
+ * Returns:
+ *      true - The zone is on the strip and its patch can be rendered
+ *      false - The zone lies beyond the end of the strip
  * Description:
- *      Applies a RGB buffer with the strip size across the LED strip.
+ *      Directs the following strip_apply_* calls into zone z. While
+ *      a zone is described, strip_size holds the length of the zone,
+ *      so patches fill their zone as they would fill an entire strip,
+ *      and the timers of the zone are used (see timer_bank).
  */
-void strip_apply_RGBbuf(RGBbuf RGBbuf)
+bool strip_zone_begin(uint8_t z)
 {
-        ws2812_prep_tx();
-        for (uint8_t i = 0; i < strip_size; i++) {
-                ws2812_tx_byte(RGBbuf[i][WS2812_WIRING_RGB_0]);
-                ws2812_tx_byte(RGBbuf[i][WS2812_WIRING_RGB_1]);
-                ws2812_tx_byte(RGBbuf[i][WS2812_WIRING_RGB_2]);
+        if (zones[z].start >= frame_strip_size) {
+                zone_cur = 0;
+                strip_size = map_size(frame_strip_size);
+                return false;
         }
-        ws2812_end_tx();
+
+        zone_cur = z + 1;
+        timer_bank(z);
+        strip_size = frame_strip_size - zones[z].start;
+
+        if (zones[z].length < strip_size)
+                strip_size = zones[z].length;
+
+        strip_size = map_size(strip_size);
+        return true;
 }
 
-/* strip_distribute_rgb
- * --------------------
+#endif
+
+/* strip_frame_end
+ * ---------------
+ * Description:
+ *      Completes the description of a frame and restores the
+ *      physical strip size. With ZONES set, the frames of all zones
+ *      are sent in a single pass, unless none of them has changed.
+ *      Pixels outside of zones, or not covered by the frame of their
+ *      zone, are set to off. Zones must be listed in ascending order
+ *      and must not overlap, zones that do are skipped. Zones are
+ *      switched in the gap between two pixels, which adds the call of
+ *      a transmit routine to the cycle budget (see pxgen_t). With
+ *      STRIP_MAP set, every zone is mapped onto its own range.
+ */
+void strip_frame_end()
+{
+        strip_size = frame_strip_size;
+        frame_strip_size = 0;
+
+#ifdef ZONES
+        uint16_t pos = 0;
+
+        zone_cur = 0;
+        timer_bank(0);
+
+        // Sign the frame by the signatures of its zones
+        frame_sig = 0xFFFF;
+        frame_signed = true;
+        for (uint8_t z = 0; z < NUM_ZONES; z++) {
+                zone_frame *zf = &zone_frames[z];
+
+                // Zones without a frame are off
+                if (!zf->tx || zones[z].start >= strip_size)
+                        continue;
+
+                frame_sig = _crc16_update(frame_sig, z);
+                frame_sig = _crc16_update(frame_sig, zf->sig & 0xFF);
+                frame_sig = _crc16_update(frame_sig, zf->sig >> 8);
+                if (!zf->sig_valid)
+                        frame_signed = false;
+        }
+
+        if (!frame_sig_dirty())
+                return;
+
+#ifdef TEMPORAL_DITHERING
+        dither_next();
+#endif
+
+        // Pass every zone trough the output stage before the
+        // transmission starts, kept frames are prepared again
+        uint16_t top = arena_top;
+        frame_tx_t tx[NUM_ZONES];
+
+        prep_round++;
+
+        for (uint8_t z = 0; z < NUM_ZONES; z++) {
+                zone_frame *zf = &zone_frames[z];
+
+                tx[z] = zf->tx;
+                if (!tx[z])
+                        continue;
+
+                out_set(zf->brightness);
+                zf->src.out = NULL;
+                if (!zf->prep(&zf->src)) {
+                        tx[z] = tx_off;
+                        tx_sig_valid = false;
+                }
+        }
+
+        strip_tx_begin();
+        for (uint8_t z = 0; z < NUM_ZONES; z++) {
+                zone_frame *zf = &zone_frames[z];
+                uint16_t start = zones[z].start;
+                uint16_t len = zones[z].length;
+
+                if (start < pos || start >= strip_size)
+                        continue;
+
+                if (len > strip_size - start)
+                        len = strip_size - start;
+
+                ws2812_tx_run(off, start - pos);
+
+                tx_stall += STRIP_SWITCH_CYCLES;
+                out_set(zf->brightness);
+                if (tx[z])
+                        map_tx(tx[z], &zf->src, len);
+                else
+                        ws2812_tx_run(off, len);
+
+                pos = start + len;
+        }
+        ws2812_tx_run(off, strip_size - pos);
+        strip_tx_end();
+
+        // Release the output colors
+        arena_top = top;
+#endif
+}
+
+#endif
+
+#if STRIP_TYPE == WS2812
+
+/* substrpbuf_cpy
+ * ---------------
  * Parameters:
- *      rgb - Array of rgb values to be distributed
- *      size - Size of the rgb array
+ *      dst - Strip object to store copy
+ *      src - Strip object to be copied
+ * Returns:
+ *      true - The copy has been created
+ *      false - The frame arena is exhausted
  * Description:
- *      Evenly distributes an array of rgb values across the LED strip.
+ *      Creates a deep copy of a substrip object in the frame
+ *      arena. The copy is valid until the end of the frame.
  */
-void strip_distribute_rgb(RGB_t rgb[], uint16_t size)
+bool substrpbuf_cpy(substrpbuf *dst, substrpbuf *src)
 {
-        substrpbuf substrpbuf;
-        substrpbuf.n_substrps = size;
-        substrpbuf.substrps = (substrp *)malloc(sizeof(substrp) * size);
+        dst->substrps = (substrp *)strip_arena_alloc(sizeof(substrp) * src->n_substrps);
 
-        for (uint16_t i = 0; i < size; i++) {
-                substrpbuf.substrps[i].length = strip_size/size;
+        if (!dst->substrps)
+                return false;
+
+        dst->n_substrps = src->n_substrps;
+        memcpy(dst->substrps, src->substrps, sizeof(substrp) * dst->n_substrps);
+
+        return true;
+}
+
+/* pxbuf_init
+ * ----------
+ * Parameters:
+ *      buf - Pointer to a pixel buffer
+ * Description:
+ *      Initializes a pixel buffer.
+ */
+void pxbuf_init(pxbuf *buf)
+{
+        buf->size = 0;
+        buf->n = 0;
+        memset(buf->removed, 0, sizeof(buf->removed));
+}
+
+/* pxbuf_mark
+ * ----------
+ * Parameters:
+ *      buf - Pointer to a pixel buffer
+ *      index - Slot index
+ *      removed - Mark the slot as removed (true) or used (false)
+ * Description:
+ *      Updates the removed bitmap of a pixel buffer.
+ */
+static inline void pxbuf_mark(pxbuf *buf, uint16_t index, bool removed)
+{
+        if (removed)
+                buf->removed[index >> 3] |= (1 << (index & 7));
+        else
+                buf->removed[index >> 3] &= ~(1 << (index & 7));
+}
+
+/* pxbuf_find
+ * ----------
+ * Parameters:
+ *      buf - Pointer to a pixel buffer
+ *      pos - Pixel position
+ * Returns:
+ *      Index of the first slot with a position greater or equal to pos,
+ *      including removed slots. Returns buf->size if there is none.
+ * Description:
+ *      Binary search over the slots of a pixel buffer. Removed slots
+ *      keep their position, so all slots remain sorted.
+ */
+static uint16_t pxbuf_find(pxbuf *buf, uint16_t pos)
+{
+        uint16_t lo = 0;
+        uint16_t hi = buf->size;
+
+        while (lo < hi) {
+                uint16_t mid = (lo + hi) >> 1;
+
+                if (buf->buf[mid].pos < pos)
+                        lo = mid + 1;
+                else
+                        hi = mid;
+        }
+
+        return lo;
+}
+
+/* pxbuf_insert
+ * -------------
+ * Parameters:
+ *      buf - Pointer to a pixel buffer
+ *      pos - Position of the pixel to be inserted
+ *      rgb - RGB value of the pixel
+ * Returns:
+ *      true - The pixel has been inserted or updated
+ *      false - The pixel buffer is full (PXBUF_SIZE pixels)
+ * Description:
+ *      Adds a pixel to the pixel buffer, or updates its color if the
+ *      position is already occupied. To keep the slots sorted, the
+ *      slots between the insertion point and the nearest free slot
+ *      are shifted by one.
+ */
+bool pxbuf_insert(pxbuf *buf, uint16_t pos, RGB_t rgb)
+{
+        uint16_t i = pxbuf_find(buf, pos);
+        uint16_t j;
+
+        // Position already has a slot
+        if (i < buf->size && buf->buf[i].pos == pos) {
+                if (!pxbuf_used(buf, i)) {
+                        pxbuf_mark(buf, i, false);
+                        buf->n++;
+                }
+                color_set(buf->buf[i].rgb, rgb);
+                return true;
+        }
+
+        if (buf->n == PXBUF_SIZE)
+                return false;
+
+        if (i > 0 && !pxbuf_used(buf, i - 1)) {
+                // Preceding slot is free
+                i--;
+        } else {
+                // Nearest free slot behind the insertion point, or a new one
+                for (j = i; j < buf->size && pxbuf_used(buf, j); j++);
+
+                if (j < PXBUF_SIZE) {
+                        if (j == buf->size)
+                                buf->size++;
+
+                        memmove(&buf->buf[i + 1], &buf->buf[i], sizeof(pxl) * (j - i));
+                } else {
+                        // Pool exhausted behind the insertion point, shift
+                        // towards the nearest free slot in front of it
+                        for (j = i - 1; pxbuf_used(buf, j); j--);
+
+                        i--;
+                        memmove(&buf->buf[j], &buf->buf[j + 1], sizeof(pxl) * (i - j));
+                }
+
+                pxbuf_mark(buf, j, false);
+        }
+
+        pxbuf_mark(buf, i, false);
+        buf->buf[i].pos = pos;
+        color_set(buf->buf[i].rgb, rgb);
+        buf->n++;
+
+        return true;
+}
+
+/* pxbuf_exists
+ * ------------
+ * Parameters:
+ *      buf - Pointer to a pixel buffer
+ *      pos - Pixel position
+ * Returns:
+ *      true - A pixel is assigned to the position
+ *      false - No pixel is assigned to the position
+ */
+bool pxbuf_exists(pxbuf *buf, uint16_t pos)
+{
+        uint16_t i = pxbuf_find(buf, pos);
+
+        return i < buf->size && buf->buf[i].pos == pos && pxbuf_used(buf, i);
+}
+
+/* pxbuf_remove
+ * -------------
+ * Parameters:
+ *      buf - Pointer to a pixel buffer
+ *      index - Index of pixel element to be deleted
+ * Description:
+ *      Deletes the pixel object stored at the provided index (NOT POSITION!).
+ *      The slot is only marked as removed, no pixels are moved.
+ */
+void pxbuf_remove(pxbuf *buf, uint16_t index)
+{
+        if (!pxbuf_used(buf, index))
+                return;
+
+        pxbuf_mark(buf, index, true);
+        buf->n--;
+
+        // Release removed slots at the end of the buffer
+        while (buf->size > 0 && !pxbuf_used(buf, buf->size - 1)) {
+                buf->size--;
+                pxbuf_mark(buf, buf->size, false);
+        }
+}
+
+/* pxbuf_remove_at
+ * ---------------
+ * Parameters:
+ *      buf - Pointer to a pixel buffer
+ *      pos - Position of pixel to be deleted from the pixel buffer
+ * Returns:
+ *      true - Pixel object deleted
+ *      false - No pixel object assigned to the position
+ * Description:
+ *      Deletes the pixel object assigned to the position.
+ */
+bool pxbuf_remove_at(pxbuf *buf, uint16_t pos)
+{
+        uint16_t i = pxbuf_find(buf, pos);
+
+        if (i < buf->size && buf->buf[i].pos == pos && pxbuf_used(buf, i)) {
+                pxbuf_remove(buf, i);
+                return true;
+        }
+
+        return false;
+}
+
+/* palbuf_init
+ * -----------
+ * Parameters:
+ *      buf - Pointer to a palettised buffer
+ *      idx - Index storage of PALBUF_BYTES(size, bits) bytes
+ *      size - Number of pixels
+ *      bits - Bits per index, 4 (16 colors) or 2 (4 colors)
+ * Description:
+ *      Initializes a palettised buffer. All pixels are set
+ *      to index 0 and all palette entries to off. Indices
+ *      wider than PALBUF_BITS are reduced to PALBUF_BITS.
+ */
+void palbuf_init(palbuf *buf, uint8_t *idx, uint16_t size, uint8_t bits)
+{
+        buf->size = size;
+        buf->bits = (bits == 2) ? 2 : PALBUF_BITS;
+        buf->gen = 0;
+        buf->idx = idx;
+
+        memset(buf->count, 0, sizeof(buf->count));
+        memset(buf->palette, 0, sizeof(buf->palette));
+        memset(idx, 0, PALBUF_BYTES(size, buf->bits));
+
+        buf->count[0] = size;
+}
+
+/* palbuf_set
+ * ----------
+ * Parameters:
+ *      buf - Pointer to a palettised buffer
+ *      pos - Position of the pixel
+ *      index - Palette index to be assigned to the pixel
+ * Description:
+ *      Assigns a palette index to a pixel. Indices beyond the
+ *      palette of the buffer (1 << bits) are wrapped, pixels
+ *      beyond the size of the buffer are ignored.
+ */
+void palbuf_set(palbuf *buf, uint16_t pos, uint8_t index)
+{
+        uint8_t *byte;
+        uint8_t shift;
+        uint8_t mask = (1 << buf->bits) - 1;
+        uint8_t prev;
+
+        if (pos >= buf->size)
+                return;
+
+        index &= mask;
+        prev = palbuf_get(buf, pos);
+
+        if (index == prev)
+                return;
+
+        if (buf->bits == 4) {
+                byte = &buf->idx[pos >> 1];
+                shift = (pos & 1) << 2;
+        } else {
+                byte = &buf->idx[pos >> 2];
+                shift = (pos & 3) << 1;
+        }
+
+        *byte = (*byte & ~(mask << shift)) | (index << shift);
+
+        buf->count[prev]--;
+        buf->count[index]++;
+        buf->gen++;
+}
+
+/* palbuf_cycle
+ * ------------
+ * Parameters:
+ *      buf - Pointer to a palettised buffer
+ *      first - First palette entry of the cycle
+ *      n - Number of palette entries in the cycle
+ * Description:
+ *      Rotates the palette entries [first, first + n) by one,
+ *      every entry takes the color of the entry before it and
+ *      the first takes the color of the last. Entries beyond the
+ *      palette of the buffer (1 << bits) are left out. Pixels keep their
+ *      indices, so the colors move trough the buffer without
+ *      touching a single pixel.
+ */
+void palbuf_cycle(palbuf *buf, uint8_t first, uint8_t n)
+{
+        color_t last[3];
+        uint8_t colors = 1 << buf->bits;
+
+        if (first >= colors || n < 2)
+                return;
+
+        if (n > colors - first)
+                n = colors - first;
+
+        color_cpy(last, buf->palette[first + n - 1]);
+        memmove(buf->palette[first + 1], buf->palette[first], sizeof(buf->palette[0]) * (n - 1));
+        color_cpy(buf->palette[first], last);
+}
+
+#ifdef COMPOSITE_PIXELS
+
+/* composite_init
+ * --------------
+ * Parameters:
+ *      c - Pointer to a composite
+ *      buf - RGB buffer of at least size pixels
+ *      size - Number of pixels
+ *      layers - Base layer, followed by the overlays
+ *      n_layers - Number of layers
+ * Description:
+ *      Initializes a composite. The base layer is marked
+ *      dirty, so the entire frame is composed when the
+ *      composite is applied for the first time.
+ */
+void composite_init(composite *c, RGBbuf buf, uint16_t size, layer *layers, uint8_t n_layers)
+{
+        c->size = size;
+        c->gen = 0;
+        c->n_layers = n_layers;
+        c->layers = layers;
+        c->buf = buf;
+#ifdef POWER_LIMITER
+        c->load = 0;
+#endif
+
+        zero_RGBbuf(buf, size);
+        layer_dirty(&layers[0], 0, size);
+}
+
+/* layer_px
+ * --------
+ * Parameters:
+ *      l - Pointer to a layer
+ *      i - Position of the pixel
+ *      rgb - RGB object to store the pixel
+ * Returns:
+ *      true - The layer covers the pixel
+ *      false - The pixel is transparent
+ */
+static bool layer_px(const layer *l, uint16_t i, RGB_ptr_t rgb)
+{
+        uint16_t px_i;
+
+        if (l->type == LAYER_GEN) {
+                l->src.gen(i, rgb);
+                return true;
+        }
+
+        px_i = pxbuf_find(l->src.px, i);
+        if (px_i < l->src.px->size && l->src.px->buf[px_i].pos == i && pxbuf_used(l->src.px, px_i)) {
+                color_get(rgb, l->src.px->buf[px_i].rgb);
+                return true;
+        }
+
+        return false;
+}
+
+/* blend_px
+ * --------
+ * Parameters:
+ *      dst - Pixel of the layers below
+ *      src - Pixel of the layer
+ *      blend - Blend mode of the layer, see layer
+ *      alpha - Opacity of BLEND_ALPHA
+ * Description:
+ *      Blends the pixel of a layer onto the pixel below.
+ */
+static void blend_px(RGB_ptr_t dst, const uint8_t *src, uint8_t blend, uint8_t alpha)
+{
+        for (uint8_t c = 0; c < 3; c++) {
+                switch (blend) {
+                        case BLEND_ADD:
+                                dst[c] = (dst[c] > 255 - src[c]) ? 255 : dst[c] + src[c];
+                                break;
+                        case BLEND_MAX:
+                                if (src[c] > dst[c])
+                                        dst[c] = src[c];
+                                break;
+                        case BLEND_ALPHA:
+                                // Both products are exact to within half a step, so their sum can't exceed 255
+                                dst[c] = scale8(src[c], alpha) + scale8(dst[c], 255 - alpha);
+                                break;
+                        case BLEND_MULTIPLY:
+                                dst[c] = scale8(dst[c], src[c]);
+                                break;
+                }
+        }
+}
+
+/* composite_span
+ * --------------
+ * Parameters:
+ *      c - Pointer to a composite
+ *      start - First pixel to be composed
+ *      end - Pixel after the last pixel to be composed
+ * Description:
+ *      Composes the pixels [start, end) from all layers.
+ */
+static void composite_span(composite *c, uint16_t start, uint16_t end)
+{
+        RGB_t px;
+
+        for (uint16_t i = start; i < end; i++) {
+                RGB_ptr_t dst = c->buf[i];
+
+#ifdef POWER_LIMITER
+                c->load -= power_px(dst);
+#endif
+
+                if (!layer_px(&c->layers[0], i, dst))
+                        rgb_cpy(dst, (RGB_ptr_t) off);
+
+                for (uint8_t l = 1; l < c->n_layers; l++) {
+                        if (layer_px(&c->layers[l], i, px))
+                                blend_px(dst, px, c->layers[l].blend, c->layers[l].alpha);
+                }
+
+#ifdef POWER_LIMITER
+                c->load += power_px(dst);
+#endif
+        }
+}
+
+/* composite_update
+ * ----------------
+ * Parameters:
+ *      c - Pointer to a composite
+ * Description:
+ *      Recomposes the dirty ranges of all layers and clears them.
+ *      Overlapping ranges are merged, so that every pixel is
+ *      composed at most once.
+ */
+static void composite_update(composite *c)
+{
+        while (true) {
+                layer *first = NULL;
+                uint16_t start, end;
+                bool merged;
+
+                // Dirty range with the lowest start
+                for (uint8_t l = 0; l < c->n_layers; l++) {
+                        layer *cur = &c->layers[l];
+
+                        if (cur->dirty_start < cur->dirty_end && (!first || cur->dirty_start < first->dirty_start))
+                                first = cur;
+                }
+
+                if (!first)
+                        return;
+
+                start = first->dirty_start;
+                end = start;
+
+                // Absorb all ranges that overlap or touch it
+                do {
+                        merged = false;
+                        for (uint8_t l = 0; l < c->n_layers; l++) {
+                                layer *cur = &c->layers[l];
+
+                                if (cur->dirty_start >= cur->dirty_end || cur->dirty_start > end)
+                                        continue;
+
+                                if (cur->dirty_end > end)
+                                        end = cur->dirty_end;
+
+                                cur->dirty_start = 0;
+                                cur->dirty_end = 0;
+                                merged = true;
+                        }
+                } while (merged);
+
+                if (end > c->size)
+                        end = c->size;
+
+                if (start < end) {
+                        composite_span(c, start, end);
+                        c->gen++;
+                }
+        }
+}
+
+#endif
+
+#endif
+
+#if STRIP_TYPE == WS2812
+
+/* tx_run
+ * ------
+ * Description:
+ *      Transmit routine of a single pixel run.
+ */
+static bool prep_run(frame_src *src)
+{
+        output_px(src->run.out, src->run.rgb);
+        return true;
+}
+
+static uint16_t tx_run(const frame_src *src, uint16_t start, uint16_t n, bool rev)
+{
+        uint16_t len = tx_len(src->run.n, start, n);
+
+        if (rev)
+                ws2812_tx_run(off, n - len);
+
+        ws2812_tx_run(src->run.out, len);
+        return rev ? n : len;
+}
+
+#endif
+
+/* strip_apply_all
+ * ---------------
+ * Parameters:
+ *      rgb - RGB value to be applied across the LED strip
+ * Description:
+ *      Applies a RGB value across the entire LED strip.
+ */
+void strip_apply_all(RGB_ptr_t rgb)
+{
+#if STRIP_TYPE == WS2812
+        frame_src src;
+
+        rgb_cpy(src.run.rgb, rgb);
+        src.run.n = strip_size;
+
+        frame_sig_begin();
+        frame_sig_run(rgb, strip_size);
+        frame_submit(tx_run, &src, prep_run);
+#else
+        RGB_t px;
+
+#ifdef TEMPORAL_DITHERING
+        dither_next();
+#endif
+        output_px(px, rgb);
+
+        NON_ADDR_STRIP_R_OCR = px[R];
+        NON_ADDR_STRIP_G_OCR = px[G];
+        NON_ADDR_STRIP_B_OCR = px[B];
+#endif
+}
+
+#if STRIP_TYPE == WS2812
+
+/* strip_apply_substrpbuf
+ * ----------------------
+ * Parameters:
+ *      substrpbuf - Sub strip buffer to be applied across the LED strip
+ * Description:
+ *      Applies a strip object across the LED strip. The output
+ *      colors of the substrips take 3 bytes each of the frame arena
+ *      while the frame is sent.
+ */
+static bool prep_substrpbuf(frame_src *src)
+{
+        RGB_ptr_t out = (RGB_ptr_t) strip_arena_alloc(sizeof(RGB_t) * src->substrps.n_substrps);
+
+        if (!out)
+                return false;
+
+        for (uint16_t i = 0; i < src->substrps.n_substrps; i++)
+                output_px(&out[i * sizeof(RGB_t)], src->substrps.substrps[i].rgb);
+
+        src->out = out;
+        return true;
+}
+
+static uint16_t tx_substrpbuf(const frame_src *src, uint16_t start, uint16_t n, bool rev)
+{
+        const substrp *substrps = src->substrps.substrps;
+        uint16_t n_substrps = src->substrps.n_substrps;
+        uint16_t size = 0;
+        uint16_t end;
+        uint16_t pos;
+
+        for (uint16_t i = 0; i < n_substrps; i++)
+                size += substrps[i].length;
+
+        end = start + tx_len(size, start, n);
+
+        if (rev)
+                ws2812_tx_run(off, n - (end - start));
+
+        // Every substrip is clipped to [start, end)
+        pos = rev ? size : 0;
+        for (uint16_t j = 0; j < n_substrps; j++) {
+                uint16_t i = rev ? n_substrps - 1 - j : j;
+                uint16_t from = rev ? pos - substrps[i].length : pos;
+                uint16_t to = from + substrps[i].length;
+
+                pos = rev ? from : to;
+
+                if (from < start)
+                        from = start;
+                if (to > end)
+                        to = end;
+                if (from < to)
+                        ws2812_tx_run(&src->out[i * sizeof(RGB_t)], to - from);
+        }
+
+        return rev ? n : end - start;
+}
+
+void strip_apply_substrpbuf(substrpbuf substrpbuf)
+{
+        frame_src src;
+
+        src.substrps.n_substrps = substrpbuf.n_substrps;
+        src.substrps.substrps = (substrp *) frame_keep(substrpbuf.substrps, sizeof(substrp) * substrpbuf.n_substrps);
+
+        if (!src.substrps.substrps) {
+                strip_apply_all((RGB_ptr_t) off);
+                return;
+        }
+
+        frame_sig_begin();
+        for (uint16_t i = 0; i < substrpbuf.n_substrps; i++)
+                frame_sig_run(substrpbuf.substrps[i].rgb, substrpbuf.substrps[i].length);
+        frame_submit(tx_substrpbuf, &src, prep_substrpbuf);
+}
+
+/* strip_apply_RGBbuf
+ * ------------------
+ * Parameters:
+ *      RGBbuf - RGB buffer to be applied across the LED strip
+ * Description:
+ *      Applies a RGB buffer with the strip size across the LED strip.
+ *      Below full brightness or with GAMMA_CORRECTION set, the output
+ *      colors are copied into the frame arena while the frame is sent,
+ *      so the arena must hold the buffer twice. Otherwise, the
+ *      buffer is streamed as is.
+ */
+static const uint8_t *prep_buf(const uint8_t *buf, uint16_t n)
+{
+        RGB_ptr_t out;
+
+        if (out_identity())
+                return buf;
+
+        out = (RGB_ptr_t) strip_arena_alloc(sizeof(RGB_t) * n);
+
+        if (out) {
+                for (uint16_t i = 0; i < n * sizeof(RGB_t); i += sizeof(RGB_t))
+                        output_px(&out[i], &buf[i]);
+        }
+
+        return out;
+}
+
+static uint16_t tx_buf(const uint8_t *buf, uint16_t size, uint16_t start, uint16_t n, bool rev)
+{
+        uint16_t len = tx_len(size, start, n);
+
+        if (!rev) {
+                ws2812_tx_buffer(buf + start * sizeof(RGB_t), len);
+                return len;
+        }
+
+        ws2812_tx_run(off, n - len);
+        for (uint16_t i = start + len; i > start; i--)
+                ws2812_tx_run(buf + (i - 1) * sizeof(RGB_t), 1);
+
+        return n;
+}
+
+static bool prep_RGBbuf(frame_src *src)
+{
+        src->out = prep_buf(src->buf.px, src->buf.n);
+        return src->out;
+}
+
+static uint16_t tx_RGBbuf(const frame_src *src, uint16_t start, uint16_t n, bool rev)
+{
+        return tx_buf(src->out, src->buf.n, start, n, rev);
+}
+
+void strip_apply_RGBbuf(RGBbuf RGBbuf)
+{
+        frame_src src;
+
+        src.buf.px = (const uint8_t *) frame_keep(RGBbuf, sizeof(RGB_t) * strip_size);
+        src.buf.n = strip_size;
+
+        if (!src.buf.px) {
+                strip_apply_all((RGB_ptr_t) off);
+                return;
+        }
+
+        frame_sig_begin();
+        for (uint16_t i = 0; i < strip_size; i++)
+                frame_sig_run(RGBbuf[i], 1);
+        frame_submit(tx_RGBbuf, &src, prep_RGBbuf);
+}
+
+/* strip_apply_palbuf
+ * ------------------
+ * Parameters:
+ *      buf - Palettised buffer to be applied across the LED strip
+ * Description:
+ *      Applies a palettised buffer across the LED strip. The
+ *      palette is passed trough the output stage into the frame
+ *      arena before the frame is sent, so pixels only cost the
+ *      lookup of their index while they are sent (see pxgen_t for
+ *      the cycle budget). The frame is not drawn if the arena
+ *      can't hold the palette.
+ *      The frame is signed by the palette, the number of
+ *      pixels per index and the generation of the indices,
+ *      so in O(palette) rather than O(pixels).
+ */
+static bool prep_palbuf(frame_src *src)
+{
+        palbuf *buf = src->pal;
+        RGB_ptr_t out = (RGB_ptr_t) strip_arena_alloc(sizeof(RGB_t) << buf->bits);
+
+        if (!out)
+                return false;
+
+        for (uint8_t i = 0; i < (1 << buf->bits); i++)
+                output_px(&out[i * sizeof(RGB_t)], buf->palette[i]);
+
+        src->out = out;
+        return true;
+}
+
+static uint16_t tx_palbuf(const frame_src *src, uint16_t start, uint16_t n, bool rev)
+{
+        const palbuf *buf = src->pal;
+        uint16_t len = tx_len((buf->size < strip_size) ? buf->size : strip_size, start, n);
+
+        if (!rev) {
+                for (uint16_t i = start; i < start + len; i++)
+                        ws2812_tx_run(&src->out[palbuf_get(buf, i) * sizeof(RGB_t)], 1);
+
+                return len;
+        }
+
+        ws2812_tx_run(off, n - len);
+        for (uint16_t i = start + len; i > start; i--)
+                ws2812_tx_run(&src->out[palbuf_get(buf, i - 1) * sizeof(RGB_t)], 1);
+
+        return n;
+}
+
+void strip_apply_palbuf(palbuf *buf)
+{
+        frame_src src;
+
+        frame_sig_begin();
+        for (uint8_t i = 0; i < (1 << buf->bits); i++) {
+                if (buf->count[i])
+                        frame_sig_run(buf->palette[i], buf->count[i]);
+        }
+
+        // Indices are only signed by their generation and buffer
+        frame_sig = _crc16_update(frame_sig, buf->gen & 0xFF);
+        frame_sig = _crc16_update(frame_sig, buf->gen >> 8);
+        frame_sig = _crc16_update(frame_sig, (uintptr_t) buf & 0xFF);
+        frame_sig = _crc16_update(frame_sig, (uintptr_t) buf >> 8);
+        frame_sig_run(off, strip_size);
+
+        src.pal = buf;
+        frame_submit(tx_palbuf, &src, prep_palbuf);
+}
+
+#ifdef COMPOSITE_PIXELS
+
+// Output value of every channel value. Composed frames are too
+// large to be copied, so their pixels are passed trough this table
+// instead of the output stage while they are sent.
+static uint8_t out_lut[256];
+static out_acc_t out_lut_factor;     // out_factor() the table has been built for
+#ifdef TEMPORAL_DITHERING
+static uint8_t out_lut_dither;       // Rounding offset the table has been built for
+#endif
+static bool out_lut_valid = false;   // False until the table has been built
+static uint8_t out_lut_round;        // Preparation round the table has been built in
+
+/* strip_apply_composite
+ * ---------------------
+ * Parameters:
+ *      c - Composite to be applied across the LED strip
+ * Description:
+ *      Recomposes the dirty ranges of a composite and applies
+ *      it across the LED strip. The composed frame is signed
+ *      by the number of compositions and power-accounted by
+ *      its load, which is updated with every recomposed pixel,
+ *      so unchanged pixels cost nothing.
+ *      Below full brightness or with GAMMA_CORRECTION set, the
+ *      output value of every channel value is looked up in out_lut,
+ *      which is only rebuilt when the brightness changes. The table
+ *      can only serve one brightness per frame, so with ZONES set,
+ *      further composites that differ in brightness are copied trough
+ *      the output stage into the frame arena, and drawn as off if
+ *      they don't fit.
+ */
+static bool prep_composite(frame_src *src)
+{
+        if (out_identity()) {
+                src->out = (const uint8_t *) src->comp->buf;
+                return true;
+        }
+
+#ifdef TEMPORAL_DITHERING
+        if (out_lut_valid && out_lut_factor == out_factor() && out_lut_dither == out_dither)
+                return true;
+#else
+        if (out_lut_valid && out_lut_factor == out_factor())
+                return true;
+#endif
+
+        // Another composite of this frame uses the table, copy
+        // the frame trough the output stage instead
+        if (out_lut_valid && out_lut_round == prep_round) {
+                src->out = prep_buf((const uint8_t *) src->comp->buf, src->comp->size);
+                return src->out;
+        }
+
+        for (uint16_t i = 0; i < 256; i++)
+                out_lut[i] = out_channel((out_acc_t) i * out_factor());
+
+        out_lut_factor = out_factor();
+#ifdef TEMPORAL_DITHERING
+        out_lut_dither = out_dither;
+#endif
+        out_lut_valid = true;
+        out_lut_round = prep_round;
+
+        return true;
+}
+
+static uint16_t tx_composite(const frame_src *src, uint16_t start, uint16_t n, bool rev)
+{
+        const composite *c = src->comp;
+        uint16_t size = (c->size < strip_size) ? c->size : strip_size;
+        uint16_t len = tx_len(size, start, n);
+        RGB_t px;
+
+        if (src->out)
+                return tx_buf(src->out, size, start, n, rev);
+
+        if (rev)
+                ws2812_tx_run(off, n - len);
+
+        for (uint16_t j = 0; j < len; j++) {
+                const uint8_t *rgb = c->buf[rev ? start + len - 1 - j : start + j];
+
+                px[R] = out_lut[rgb[R]];
+                px[G] = out_lut[rgb[G]];
+                px[B] = out_lut[rgb[B]];
+                ws2812_tx_run(px, 1);
+        }
+
+        return rev ? n : len;
+}
+
+void strip_apply_composite(composite *c)
+{
+        frame_src src;
+
+        composite_update(c);
+
+        frame_sig_begin();
+        frame_sig = _crc16_update(frame_sig, c->gen & 0xFF);
+        frame_sig = _crc16_update(frame_sig, c->gen >> 8);
+        frame_sig = _crc16_update(frame_sig, (uintptr_t) c & 0xFF);
+        frame_sig = _crc16_update(frame_sig, (uintptr_t) c >> 8);
+        frame_sig_run(off, strip_size);
+
+#ifdef POWER_LIMITER
+        power_load = c->load;
+#endif
+
+        src.comp = c;
+        frame_submit(tx_composite, &src, prep_composite);
+}
+
+#endif
+
+/* strip_distribute_rgb
+ * --------------------
+ * Parameters:
+ *      rgb - Array of rgb values to be distributed
+ *      size - Size of the rgb array
+ * Description:
+ *      Evenly distributes an array of rgb values across the LED strip.
+ *      The substrips are allocated from the frame arena. If the arena
+ *      can't hold them, the strip (or zone) is turned off.
+ */
+void strip_distribute_rgb(RGB_t rgb[], uint16_t size)
+{
+        substrpbuf substrpbuf;
+        substrpbuf.n_substrps = size;
+        substrpbuf.substrps = (substrp *)strip_arena_alloc(sizeof(substrp) * size);
+
+        if (!substrpbuf.substrps) {
+                strip_apply_all((RGB_ptr_t) off);
+                return;
+        }
+
+        for (uint16_t i = 0; i < size; i++) {
+                substrpbuf.substrps[i].length = strip_size/size;
+
+                if (i == size - 1)
+                        substrpbuf.substrps[i].length += strip_size % size;
+
+                color_set(substrpbuf.substrps[i].rgb, rgb[i]);
+        }
+
+        strip_apply_substrpbuf(substrpbuf);
+}
+
+#endif
+
+// Effects keep their state in one bank per zone, selected by
+// strip_zone_begin like the timers (see timer_bank), so that
+// zones running the same effect don't advance each other.
+#ifdef ZONES
+#define NUM_FX_BANKS NUM_ZONES
+#define FX_BANK (zone_cur ? zone_cur - 1 : 0)
+#else
+#define NUM_FX_BANKS 1
+#define FX_BANK 0
+#endif
+
+/* FX_STATE
+ * --------
+ * Parameters:
+ *      type - Type of the state variable
+ *      name - Name of the state variable
+ * Description:
+ *      Declares a static state variable of an effect, zero
+ *      initialized and kept once per zone. Within the effect,
+ *      name refers to the variable of the current zone.
+ */
+#define FX_STATE(type, name) \
+        static type name##_banks[NUM_FX_BANKS]; \
+        type &name = name##_banks[FX_BANK]
+
+/* FX_STATE_ARRAY
+ * --------------
+ * Parameters:
+ *      type - Element type of the state array
+ *      name - Name of the state array
+ *      size - Number of elements
+ * Description:
+ *      Same as FX_STATE for arrays, name points to the
+ *      first element of the array of the current zone.
+ */
+#define FX_STATE_ARRAY(type, name, size) \
+        static type name##_banks[NUM_FX_BANKS][size]; \
+        type *name = name##_banks[FX_BANK]
+
+/* anim_steps
+ * ----------
+ * Parameters:
+ *      acc - Time accumulator of the animation
+ *      dt - Duration of the current frame in ms (see input_frame)
+ *      delay_ms - Time in ms per animation step
+ * Description:
+ *      Adds the duration of the current frame (dt) to the
+ *      animation's time accumulator and returns the number of
+ *      steps that are due. Animations advance by these steps rather
+ *      than by call count, so their speed does not depend on the
+ *      frame rate. Must be called once per frame.
+ */
+static uint16_t anim_steps(uint16_t *acc, uint16_t dt, uint16_t delay_ms)
+{
+        uint16_t steps;
+
+        if (delay_ms == 0)
+                delay_ms = 1;
+
+        *acc += dt;
+        steps = *acc / delay_ms;
+        *acc -= steps * delay_ms;
+
+        return steps;
+}
+
+/* brightness_fade
+ * ---------------
+ * Parameters:
+ *      step_size - Brightness steps to be taken
+ *      start - Restart the fade from 0
+ * Returns:
+ *      The current brightness of the fade
+ * Description:
+ *      Fades the brightness up to 255 and back down to 0.
+ */
+static uint8_t brightness_fade(uint16_t step_size, bool start)
+{
+        FX_STATE(bool, dec);
+        FX_STATE(int, brightness);
+
+        if (start) {
+                dec = false;
+                brightness = 0;
+        }
+
+        if (!dec) {
+                brightness += step_size;
+                if (brightness >= 255) {
+                        brightness = 255;
+                }
+                dec = brightness >= 255;
+        } else { 
+                brightness -= step_size;
+                if (brightness < 0) {
+                        brightness = 0;
+                }
+                dec = brightness != 0;
+        }
+
+        return brightness;
+}
+
+/* strip_fade
+ * ----------
+ * Parameters:
+ *      in - Input frame of the current main loop iteration
+ *      rgb - RGB value to be faded
+ *      delay_ms - Delay in ms between each step
+ *      step_size - Brightness steps
+ *      start - Restart the fade from 0
+ * Returns:
+ *      True - Fade has reached 0
+ *      False - Amidst fade
+ * Description:
+ *      Fades the provided RGB value in and out across the entire strip.
+ *      The fade is applied as master brightness, so the output stage
+ *      can dither it (see TEMPORAL_DITHERING). The strip is therefore
+ *      rendered on every call, not just when the fade advances.
+ */
+bool strip_fade(const input_frame *in, RGB_ptr_t rgb, uint16_t delay_ms, uint8_t step_size, bool start)
+{
+        FX_STATE(uint8_t, brightness);
+        FX_STATE(uint16_t, acc);
+
+        bool ret = false;
+
+        // Restart right away, a start on a frame without a
+        // step would otherwise be lost
+        if (start) {
+                brightness = brightness_fade(0, true);
+                acc = 0;
+        }
+
+        uint16_t steps = anim_steps(&acc, in->dt, delay_ms);
+
+        if (steps != 0) {
+                // Brightness saturates after 255 anyway
+                steps *= step_size;
+                if (steps > 255)
+                        steps = 255;
+
+                brightness = brightness_fade(steps, false);
+                ret = (brightness == 0);
+        }
+
+        strip_set_brightness(brightness);
+        strip_apply_all(rgb);
+
+        return ret;
+}
+
+/* strip_breathe
+ * -------------
+ * Parameters:
+ *      in - Input frame of the current main loop iteration
+ *      rgb - RGB value to be "breathed"
+ *      dealy_ms - Delay in ms between each step
+ *      step_size - Color steps during breath
+ * Returns:
+ *      True - Breath completed
+ *      False - Amidst breath
+ * Description:
+ *      "Breathes" the provided RGB value across the entire strip.
+ */
+bool strip_breathe(const input_frame *in, RGB_ptr_t rgb, uint16_t delay_ms, uint8_t step_size)
+{
+        FX_STATE(bool, done);
+
+        if (done) {
+                if (!timer_expired(TMR_ANIM_AUX, in->ms))
+                        return false;
+                done = false;
+        }
+
+        done = strip_fade(in, rgb, delay_ms, step_size, false);
+
+        // Pause for 2 seconds after each breath
+        if (done)
+                timer_arm(TMR_ANIM_AUX, 2000, in->ms);
+
+        return done;
+}
+
+/* strip_breathe_array
+ * -------------------
+ * Parameters:
+ *      in - Input frame of the current main loop iteration
+ *      rgb - Arrat of RGB values to be "breathed"
+ *      size - Size of the RGB array
+ *      dealy_ms - Delay in ms between each step
+ *      step_size - Color steps during breath
+ * Description:
+ *      "Breathes" the provided RGB values across the entire strip.
+ */
+void strip_breathe_array(const input_frame *in, RGB_t rgb[], uint8_t size, uint16_t delay_ms, uint8_t step_size)
+{
+        FX_STATE(uint8_t, i);
+
+        if(strip_breathe(in, rgb[i], delay_ms, step_size))
+                i = (i + 1) % size;
+}
+
+/* strip_rainbow
+ * -------------
+ * Parameters:
+ *      in - Input frame of the current main loop iteration
+ *      step_size - Color steps between each call.
+ *                  A greater value results in faster fading.
+ *      brightness - Brightness value (0 = 0%, 255 = 100%) of the fade
+ * Description:
+ *      Gradiently fades all LEDs simultaneously trough the RGB spectrum.
+ */
+void strip_rainbow(const input_frame *in, uint8_t step_size, uint16_t delay, uint8_t brightness)
+{
+        FX_STATE(hue_t, hue);
+        FX_STATE(uint16_t, acc);
+
+        RGB_t rgb;
+        uint16_t steps = anim_steps(&acc, in->dt, delay);
+
+        if (steps == 0)
+                return;
+
+        hue = hue_add(hue, steps * (step_size ? step_size : 1));
+        hsv2rgb(hue, 255, 255, rgb);
+
+        strip_set_brightness(brightness);
+        strip_apply_all(rgb);
+}
+
+/* strip_scroll_rgb
+ * -------------
+ * Parameters:
+ *      val - Hue (see hue_t), starting at red
+ *      brightness - Brightness (0 = 0%, 255 = 100%)
+ * Description:
+ *      Sets the rgb strip to a hue on the color wheel.
+ */
+
+void strip_scroll_rgb(uint16_t val, uint8_t brightness) {
+        RGB_t rgb;
+
+        hsv2rgb(hue_add(0, val), 255, 255, rgb);
+
+        strip_set_brightness(brightness);
+        strip_apply_all(rgb);
+}
+
+/* strip_breathe_random
+ * --------------------
+ * Parameters:
+ *      in - Input frame of the current main loop iteration
+ *      step_size - Brightness steps during breath.
+ * Description:
+ *      "Breathes" random RGB values across the entire strip.
+ *      Due to the rather poor randomness of rand(), the outcomes tend
+ *      to be similar.
+ */
+void strip_breathe_random(const input_frame *in, uint16_t delay_ms, uint8_t step_size)
+{
+        FX_STATE(RGB_t, rgb);
+
+        if (rgb[R] == 0 && rgb[G] == 0 && rgb[B] == 0) {
+                rgb[R] = 255;
+                rgb[G] = 255;
+                rgb[B] = 255;
+        }
+        
+        if (strip_breathe(in, rgb, delay_ms, step_size)) {
+                rgb[R] = (rand() % 256);
+                rgb[G] = (rand() % 256);
+                rgb[B] = (rand() % 256);
+        }
+}
+
+/* strip_breathe_rainbow
+ * ---------------------
+ * Parameters:
+ *      in - Input frame of the current main loop iteration
+ *      breath_step_size - Brightness steps during breath.
+ *      rgb_step_size - Color steps.
+ * Description:
+ *      Gradiently "Breathes" trough the rgb spectrum
+ */
+void strip_breathe_rainbow(const input_frame *in, uint16_t delay_ms, uint8_t breath_step_size, uint8_t rgb_step_size)
+{
+        FX_STATE(hue_t, hue);
+
+        RGB_t rgb;
+
+        hsv2rgb(hue, 255, 255, rgb);
+        if (strip_breathe(in, rgb, delay_ms, breath_step_size))
+                hue = hue_add(hue, rgb_step_size ? rgb_step_size : 1);
+}
+
+#if STRIP_TYPE == WS2812
+
+/* rainbow_pos
+ * -----------
+ * Description:
+ *      Pixel of the rotating rainbow. The position of the hue
+ *      within its section (hue & 0xFF) is kept multiplied by
+ *      out_factor(), so that stepping from pixel to pixel only
+ *      takes additions and the output stage no multiplication
+ *      (see out_channel). The colors equal those of hsv2rgb
+ *      at full saturation and value.
+ */
+typedef struct rainbow_pos {
+        hue_t hue;
+        out_acc_t f;               // (hue & 0xFF) * out_factor()
+} rainbow_pos;
+
+/* rainbow_seek
+ * ------------
+ * Parameters:
+ *      p - Pixel of the rotating rainbow
+ *      hue - Hue of the pixel
+ */
+static void rainbow_seek(rainbow_pos *p, hue_t hue)
+{
+        p->hue = hue;
+        p->f = (out_acc_t) (hue & 0xFF) * out_factor();
+}
+
+/* rainbow_next
+ * ------------
+ * Parameters:
+ *      p - Pixel of the rotating rainbow
+ *      step - Hue steps between two pixels
+ *      inc - step * out_factor()
+ *      rev - Step backwards
+ * Description:
+ *      Steps to the next pixel. When the hue crosses into the
+ *      next section, its position within the section drops
+ *      by 256 steps (and rises by 256 if stepped backwards).
+ */
+static inline void rainbow_next(rainbow_pos *p, uint8_t step, out_acc_t inc, bool rev)
+{
+        uint8_t f = p->hue & 0xFF;
+
+        if (rev) {
+                p->hue = (p->hue >= step) ? p->hue - step : p->hue + HUE_MAX - step;
+                p->f -= inc;
+                if (step > f)
+                        p->f += out_factor() << 8;
+        } else {
+                p->hue = hue_add(p->hue, step);
+                p->f += inc;
+                if ((uint8_t) (f + step) < f)
+                        p->f -= out_factor() << 8;
+        }
+}
+
+/* rainbow_px
+ * ----------
+ * Parameters:
+ *      p - Pixel of the rotating rainbow
+ *      rgb - RGB object to store the output color of the pixel
+ * Description:
+ *      Same as hsv2rgb at full saturation and value, passed
+ *      trough the output stage. The fading channels are the
+ *      lines of hsv2rgb in units of out_factor().
+ */
+static inline void rainbow_px(const rainbow_pos *p, RGB_ptr_t rgb)
+{
+        out_acc_t up = p->f;
+        out_acc_t down = (out_factor() << 8) - out_factor() - p->f; // 255 - f
+
+        switch (p->hue >> 8) {
+                case 0 : {
+#ifdef RAINBOW_HUES
+                        // h = f >> 1, f - 2h is 1 for odd f
+                        out_acc_t h = (p->f - ((p->hue & 1) ? out_factor() : 0)) >> 1;
+
+                        if ((p->hue & 0xFF) < 128) {
+                                up = p->f + h;                                             // f + (f >> 1)
+                                down = (out_factor() << 8) - out_factor() - h;             // 255 - (f >> 1)
+                        } else {
+                                up = (out_factor() << 7) + h;                              // 192 + ((f - 128) >> 1)
+                                down = (out_factor() << 8) + (out_factor() << 7) - out_factor() - h - p->f; // 191 - ...
+                        }
+#endif
+                        rgb[R] = out_channel(down);
+                        rgb[G] = out_channel(up);
+                        rgb[B] = 0;
+                        break;
+                }
+                case 1 : {
+                        rgb[R] = 0;
+                        rgb[G] = out_channel(down);
+                        rgb[B] = out_channel(up);
+                        break;
+                }
+                default: {
+                        rgb[R] = out_channel(up);
+                        rgb[G] = 0;
+                        rgb[B] = out_channel(down);
+                        break;
+                }
+        }
+}
+
+#ifdef POWER_LIMITER
+
+/* rainbow_load
+ * ------------
+ * Parameters:
+ *      hue - Hue of the first pixel
+ *      step_size - Hue steps between each pixel
+ *      n - Number of pixels
+ * Returns:
+ *      Load of n pixels of the rotating rainbow, see power_run
+ */
+static uint32_t rainbow_load(hue_t hue, uint8_t step_size, uint16_t n)
+{
+        uint32_t load = 0;
+        RGB_t rgb;
+
+        while (n--) {
+                hsv2rgb(hue, 255, 255, rgb);
+                load += power_px(rgb);
+                hue = hue_add(hue, step_size);
+        }
+
+        return load;
+}
+
+#endif
+
+#if defined(HUE_RING_SIZE) && HUE_RING_SIZE > 0
+
+// The hues of the rotating rainbow repeat after a fixed number of
+// pixels (the period). If the period fits into the hue ring, the
+// output colors of one period are computed once per step size and
+// brightness, and every frame is streamed from the ring, starting
+// at a rotating offset. With ZONES set, the ring serves the zone
+// that built it last, other zones compute their pixels on the fly.
+static RGB_t hue_ring[HUE_RING_SIZE];
+static uint16_t hue_ring_len = 0;  // Period of the ring, 0 if the ring is unused
+static uint8_t hue_ring_step = 0;  // Step size the ring has been built for
+static uint16_t hue_ring_gen = 0;  // Incremented whenever the ring is built
+static hue_t hue_ring_hue;         // Hue of the first ring entry
+static bool hue_ring_filled;       // False until the output colors of the ring are computed
+static out_acc_t hue_ring_factor;  // out_factor() the ring has been filled for
+static uint8_t hue_ring_round;     // Preparation round the ring has been filled in
+#ifdef TEMPORAL_DITHERING
+static uint8_t hue_ring_dither;    // Rounding offset the ring has been filled for
+#endif
+#ifdef POWER_LIMITER
+static uint32_t hue_ring_load;     // Load of one period, see power_run
+#endif
+
+/* hue_period
+ * ----------
+ * Parameters:
+ *      step_size - Hue steps between each pixel
+ * Returns:
+ *      Number of pixels after which the hues repeat,
+ *      that is HUE_MAX / gcd(step_size, HUE_MAX)
+ */
+static uint16_t hue_period(uint8_t step_size)
+{
+        uint16_t period = HUE_MAX; // 2^8 * 3
+
+        while (!(step_size & 1)) {
+                step_size >>= 1;
+                period >>= 1;
+        }
+
+        if (step_size % 3 == 0)
+                period /= 3;
+
+        return period;
+}
+
+/* hue_ring_build
+ * --------------
+ * Parameters:
+ *      hue - Hue of the first pixel
+ *      step_size - Hue steps between each pixel
+ * Description:
+ *      Sets the hue ring up for one period of the rotating
+ *      rainbow, its output colors are computed by hue_ring_fill.
+ *      The ring is left unused if the period exceeds HUE_RING_SIZE.
+ */
+static void hue_ring_build(hue_t hue, uint8_t step_size)
+{
+        uint16_t period = hue_period(step_size);
+
+        hue_ring_step = step_size;
+        hue_ring_gen++;
+        hue_ring_len = 0;
+
+        if (period > HUE_RING_SIZE)
+                return;
+
+#ifdef POWER_LIMITER
+        hue_ring_load = rainbow_load(hue, step_size, period);
+#endif
+
+        hue_ring_hue = hue;
+        hue_ring_filled = false;
+        hue_ring_len = period;
+}
+
+/* hue_ring_fill
+ * -------------
+ * Parameters:
+ *      inc - Step size of the ring times out_factor()
+ * Returns:
+ *      true - The ring holds the output colors of the current output stage
+ *      false - The ring has been filled for another brightness of this frame
+ * Description:
+ *      Computes the output colors of the hue ring, unless
+ *      they have been computed for the current output stage.
+ */
+static bool hue_ring_fill(out_acc_t inc)
+{
+        rainbow_pos p;
+
+#ifdef TEMPORAL_DITHERING
+        if (hue_ring_filled && hue_ring_factor == out_factor() && hue_ring_dither == out_dither)
+                return true;
+#else
+        if (hue_ring_filled && hue_ring_factor == out_factor())
+                return true;
+#endif
+
+        if (hue_ring_filled && hue_ring_round == prep_round)
+                return false;
+
+        rainbow_seek(&p, hue_ring_hue);
+        for (uint16_t i = 0; i < hue_ring_len; i++) {
+                rainbow_px(&p, hue_ring[i]);
+                rainbow_next(&p, hue_ring_step, inc, false);
+        }
+
+        hue_ring_factor = out_factor();
+#ifdef TEMPORAL_DITHERING
+        hue_ring_dither = out_dither;
+#endif
+        hue_ring_round = prep_round;
+        hue_ring_filled = true;
+
+        return true;
+}
+
+/* strip_tx_hue_ring
+ * -----------------
+ * Parameters:
+ *      ring_pos - Ring index of the first pixel of the frame
+ *      start - Index of the first pixel to be sent
+ *      n - Number of pixels to be sent
+ *      rev - Send the pixels in descending order
+ * Description:
+ *      Sends n pixels from the hue ring. Every lap of the
+ *      ring is streamed in one go. Reversed pixels are sent
+ *      one by one.
+ */
+static void strip_tx_hue_ring(uint16_t ring_pos, uint16_t start, uint16_t n, bool rev)
+{
+        uint16_t pos = (ring_pos + start % hue_ring_len) % hue_ring_len;
+
+        if (rev) {
+                if (n)
+                        pos = (pos + (n - 1) % hue_ring_len) % hue_ring_len;
+
+                while (n--) {
+                        ws2812_tx_run(hue_ring[pos], 1);
+                        pos = pos ? pos - 1 : hue_ring_len - 1;
+                }
+                return;
+        }
+
+        while (n) {
+                uint16_t len = hue_ring_len - pos;
 
-                if (i == size - 1)
-                        substrpbuf.substrps[i].length += strip_size % size;
+                if (len > n)
+                        len = n;
 
-                rgb_cpy(substrpbuf.substrps[i].rgb, rgb[i]);
+                ws2812_tx_buffer((const uint8_t *) hue_ring[pos], len);
+                n -= len;
+                pos = 0;
         }
-
-        strip_apply_substrpbuf(substrpbuf);
-        substrpbuf_free(&substrpbuf);
 }
 
 #endif
 
-bool rgb_apply_brightness_fade(RGB_ptr_t rgb_in, RGB_ptr_t rgb_out, uint16_t step_size, bool start)
+static bool prep_rotate_rainbow(frame_src *src)
 {
-        static bool inc = true;
-        static int brightness = 0;
+        uint32_t t;
+        rainbow_pos p;
+        RGB_t px;
 
-        if (start) {
-                inc = true;
-                brightness = 0;
-        }
+        src->rainbow.inc = (out_acc_t) src->rainbow.step * out_factor();
 
-        rgb_cpy(rgb_out, rgb_in);
+#if defined(HUE_RING_SIZE) && HUE_RING_SIZE > 0
+        // The ring may have been built for another zone since
+        src->rainbow.ring = hue_ring_len && src->rainbow.ring_gen == hue_ring_gen &&
+                            hue_ring_fill(src->rainbow.inc);
+        if (src->rainbow.ring)
+                return true;
+#endif
 
-        if (inc) {
-                brightness += step_size;
-                if (brightness >= 255) {
-                        brightness = 255;
-                        inc = false;
-                }
-                inc = brightness < 255;
-        } else { 
-                brightness -= step_size;
-                if (brightness < 0) {
-                        brightness = 0;
-                }
-                inc = brightness == 0;
+        // Pixels are computed between kernel calls, see tx_stall
+        t = clock_us();
+        rainbow_seek(&p, src->rainbow.hue);
+        for (uint8_t i = 0; i < STRIP_PX_SAMPLES; i++) {
+                rainbow_px(&p, px);
+                tx_sink = px[R] ^ px[G] ^ px[B];
+                rainbow_next(&p, src->rainbow.step, src->rainbow.inc, false);
         }
+        src->rainbow.cycles = tx_cycles_per_px(t);
 
-        rgb_apply_brightness(rgb_out, brightness);
-        return (brightness == 0);
+        return true;
 }
 
-bool strip_fade(RGB_ptr_t rgb, uint16_t delay_ms, uint8_t step_size, bool start)
+static uint16_t tx_rotate_rainbow(const frame_src *src, uint16_t start, uint16_t n, bool rev)
 {
-        static RGB_t rgb_out;
-
-        if (ms_passed() <= delay_ms)
-                return false;
+        uint16_t len = tx_len(strip_size, start, n);
+        uint16_t first = rev ? start + len - 1 : start;
+        rainbow_pos p;
+        RGB_t px;
+
+        if (rev)
+                ws2812_tx_run(off, n - len);
+
+#if defined(HUE_RING_SIZE) && HUE_RING_SIZE > 0
+        if (src->rainbow.ring) {
+                strip_tx_hue_ring(src->rainbow.ring_pos, start, len, rev);
+                return rev ? n : len;
+        }
+#endif
 
-        bool ret;
-        if (start)
-                ret = rgb_apply_brightness_fade(rgb, rgb_out, step_size, true);
+        // Every pixel steps from the hue of the pixel sent before
+        // it, so the rainbow starts at the hue of the first pixel
+        // and steps backwards if reversed
+        if (len && first)
+                rainbow_seek(&p, hue_add(src->rainbow.hue, hue_mul(first, src->rainbow.step)));
         else
-                ret = rgb_apply_brightness_fade(rgb, rgb_out, step_size, false);
-        
-        strip_apply_all(rgb_out);
-        reset_timer();
+                rainbow_seek(&p, src->rainbow.hue);
 
-        return ret;
+        tx_stall += (uint32_t) len * src->rainbow.cycles;
+        for (uint16_t j = 0; j < len; j++) {
+                rainbow_px(&p, px);
+                ws2812_tx_run(px, 1);
+                rainbow_next(&p, src->rainbow.step, src->rainbow.inc, rev);
+        }
+
+        return rev ? n : len;
 }
 
-/* strip_breathe
- * -------------
- * Parameters:
- *      rgb - RGB value to be "breathed"
- *      dealy_ms - Delay in ms between each step
- *      step_size - Color steps during breath
- * Returns:
- *      True - Breath completed
- *      False - Amidst breath
+/* strip_rotate_rainbow
+ * --------------------
+ *  * Parameters:
+ *      in - Input frame of the current main loop iteration
+ *      step_size - Color steps between each pixel
  * Description:
- *      "Breathes" the provided RGB value across the entire strip.
+ *      Rotates the rgb spectrum across the strip.
+ *      Unlike other RGB fade effects, this one doesn't 
+ *      allow for changes in speed, as the addition of delays, 
+ *      changes in step size, and even just additional code can
+ *      easily lead to uncomfortable lag.
  */
-bool strip_breathe(RGB_ptr_t rgb, uint16_t delay_ms, uint8_t step_size)
+void strip_rotate_rainbow(const input_frame *in, uint8_t step_size, uint16_t delay_ms)
 {
-        static bool done = false;
+        FX_STATE(hue_t, hue);
+        FX_STATE(uint16_t, acc);
+#if defined(HUE_RING_SIZE) && HUE_RING_SIZE > 0
+        FX_STATE(uint16_t, ring_pos);
+        FX_STATE(uint16_t, ring_gen);
+#endif
 
-        if (done && ms_passed() < 2000)
-                return false;
-        else if (ms_passed() >= 2000)
-                done = false;
+        RGB_t rgb;
+        frame_src src;
+        uint16_t steps = anim_steps(&acc, in->dt, delay_ms);
 
-        done = strip_fade(rgb, delay_ms, step_size, false);
+        if (steps == 0)
+                return;
 
-        return done;
+        if (step_size == 0)
+                step_size = 1;
+
+        hue = hue_add(hue, steps * step_size);
+        hsv2rgb(hue, 255, 255, rgb);
+
+        src.rainbow.hue = hue;
+        src.rainbow.step = step_size;
+
+#if defined(HUE_RING_SIZE) && HUE_RING_SIZE > 0
+        if (step_size != hue_ring_step || ring_gen != hue_ring_gen) {
+                hue_ring_build(hue, step_size);
+                ring_gen = hue_ring_gen;
+                ring_pos = 0;
+        } else if (hue_ring_len) {
+                ring_pos = (ring_pos + steps) % hue_ring_len;
+        }
+
+        src.rainbow.ring_pos = ring_pos;
+        src.rainbow.ring_gen = ring_gen;
+#endif
+
+        // The frame is fully determined by its first pixel and the step size
+        frame_sig_begin();
+        frame_sig_run(rgb, strip_size);
+        frame_sig = _crc16_update(frame_sig, step_size);
+
+#ifdef POWER_LIMITER
+        // Only the first pixel has been signed, add up the load of the whole rainbow
+#if defined(HUE_RING_SIZE) && HUE_RING_SIZE > 0
+        if (hue_ring_len)
+                power_load = hue_ring_load / hue_ring_len * strip_size;
+        else
+#endif
+        power_load = rainbow_load(hue, step_size, strip_size);
+#endif
+
+        frame_submit(tx_rotate_rainbow, &src, prep_rotate_rainbow);
 }
 
-/* strip_breathe_array
+#ifdef PALBUF_PIXELS
+
+/* strip_cycle_rainbow
  * -------------------
  * Parameters:
- *      rgb - Arrat of RGB values to be "breathed"
- *      size - Size of the RGB array
- *      dealy_ms - Delay in ms between each step
- *      step_size - Color steps during breath
+ *      in - Input frame of the current main loop iteration
+ *      band_width - Pixels per color band
+ *      delay_ms - Delay in ms between each step
  * Description:
- *      "Breathes" the provided RGB values across the entire strip.
+ *      Rotates bands of PALETTE_SIZE rainbow colors (see
+ *      PALBUF_BITS) across the strip. The bands are drawn once
+ *      into a palettised buffer of PALBUF_PIXELS pixels, every
+ *      step only cycles its palette. Pixels beyond PALBUF_PIXELS
+ *      are off.
  */
-void strip_breathe_array(RGB_t rgb[], uint8_t size, uint16_t delay_ms, uint8_t step_size)
+void strip_cycle_rainbow(const input_frame *in, uint16_t band_width, uint16_t delay_ms)
 {
-        static uint8_t i = 0;
+        FX_STATE_ARRAY(uint8_t, idx, PALBUF_BYTES(PALBUF_PIXELS, PALBUF_BITS));
+        FX_STATE(palbuf, buf);
+        FX_STATE(uint16_t, width);
+        FX_STATE(uint16_t, acc);
 
-        if(strip_breathe(rgb[i], delay_ms, step_size))
-                i = (i + 1) % size;
-}
+        uint16_t steps = anim_steps(&acc, in->dt, delay_ms);
+        uint16_t size = (strip_size < PALBUF_PIXELS) ? strip_size : PALBUF_PIXELS;
 
-/* strip_rainbow
- * -------------
- * Parameters:
- *      step_size - Color steps between each call.
- *                  A greater value results in faster fading.
- *      brightness - Brightness value (0 = 0%, 255 = 100%) of the fade
- * Description:
- *      Gradiently fades all LEDs simultaneously trough the RGB spectrum.
- */
-void strip_rainbow(uint8_t step_size, uint16_t delay, uint8_t brightness)
-{
-        static RGB_t rgb = {255, 0, 0};
+        if (band_width == 0)
+                band_width = 1;
 
-        RGB_t rgbcpy;
+        // (Re)draw the bands
+        if (band_width != width || buf.size != size) {
+                palbuf_init(&buf, idx, size, PALBUF_BITS);
 
-        if (ms_passed() < delay)
-                return;
+                for (uint8_t i = 0; i < PALETTE_SIZE; i++) {
+                        RGB_t rgb;
 
-        rgb_apply_fade(rgb, step_size);
-        
-        if (brightness < 255) {
-                rgb_cpy(rgbcpy, rgb);
-                rgb_apply_brightness(rgbcpy, brightness);
-                strip_apply_all(rgbcpy);
-        } else {
-                strip_apply_all(rgb);
+                        hsv2rgb(i * (HUE_MAX / PALETTE_SIZE), 255, 255, rgb);
+                        color_set(buf.palette[i], rgb);
+                }
+
+                for (uint16_t i = 0; i < buf.size; i++)
+                        palbuf_set(&buf, i, i / band_width);
+
+                width = band_width;
         }
 
-        reset_timer();
+        if (steps > PALETTE_SIZE)
+                steps %= PALETTE_SIZE;
+
+        while (steps--)
+                palbuf_cycle(&buf, 0, PALETTE_SIZE);
+
+        strip_apply_palbuf(&buf);
 }
 
-/* strip_scroll_rgb
- * -------------
+#endif
+
+/* strip_apply_pxbuf
+ * -----------------
  * Parameters:
- *      val - RGB wheel offset from start (red) 
+ *      pxbuf - Pixel buffer to be applied across the LED strip
  * Description:
- *      Sets the rgb strip to a value on a RGB wheel.
+ *      Applies a pixel buffer across the LED strip.
+ *      The output colors of the pixels are kept in their slots.
  */
+static bool prep_pxbuf(frame_src *src)
+{
+        pxbuf *buf = src->px;
 
-void strip_scroll_rgb(uint16_t val, uint8_t brightness) {
-        RGB_t rgb;
+        for (uint16_t px_i = 0; px_i < buf->size; px_i++) {
+                if (pxbuf_used(buf, px_i))
+                        output_px(buf->buf[px_i].out, buf->buf[px_i].rgb);
+        }
 
-        val %= 765;
-
-        if (val < 255 + 1) {
-                rgb[R] = 255 - val;
-                rgb[G] = val;
-                rgb[B] = 0;        
-        } else if (val < (2 * 255) + 1) {
-                val -= 255;
-                rgb[R] = 0;
-                rgb[G] = 255 - val;
-                rgb[B] = val;
-        } else {
-                val -= 510;
-                rgb[R] = val;
-                rgb[G] = 0;
-                rgb[B] = 255 - val;
+        return true;
+}
+
+static uint16_t tx_pxbuf(const frame_src *src, uint16_t start, uint16_t n, bool rev)
+{
+        pxbuf *buf = src->px;
+        uint16_t end = start + tx_len(strip_size, start, n);
+        uint16_t i;
+
+        if (rev) {
+                ws2812_tx_run(off, n - (end - start));
+
+                // Walk the slots backwards from the last pixel before end
+                i = end;
+                for (uint16_t px_i = pxbuf_find(buf, end); px_i > 0 && buf->buf[px_i - 1].pos >= start; px_i--) {
+                        if (!pxbuf_used(buf, px_i - 1))
+                                continue;
+
+                        ws2812_tx_run(off, i - buf->buf[px_i - 1].pos - 1);
+                        ws2812_tx_run(buf->buf[px_i - 1].out, 1);
+                        i = buf->buf[px_i - 1].pos;
+                }
+                ws2812_tx_run(off, i - start);
+
+                return n;
         }
 
-        rgb_apply_brightness(rgb, brightness);
-        strip_apply_all(rgb);
+        // Pixels are sorted by position, so the gaps
+        // between them can be sent as runs of black
+        i = start;
+        for (uint16_t px_i = pxbuf_find(buf, start); px_i < buf->size && buf->buf[px_i].pos < end; px_i++) {
+                if (!pxbuf_used(buf, px_i))
+                        continue;
+
+                ws2812_tx_run(off, buf->buf[px_i].pos - i);
+                ws2812_tx_run(buf->buf[px_i].out, 1);
+                i = buf->buf[px_i].pos + 1;
+        }
+        ws2812_tx_run(off, end - i);
+
+        return end - start;
 }
 
-/* strip_breathe_random
- * --------------------
- * Parameters:
- *      step_size - Brightness steps during breath.
- * Description:
- *      "Breathes" random RGB values across the entire strip.
- *      Due to the rather poor randomness of rand(), the outcomes tend
- *      to be similar.
- */
-void strip_breathe_random(uint16_t delay_ms, uint8_t step_size)
+void strip_apply_pxbuf(pxbuf *buf)
 {
-        static RGB_t rgb;
+        frame_src src;
 
-        if (rgb[R] == 0 && rgb[G] == 0 && rgb[B] == 0) {
-                rgb[R] = 255;
-                rgb[G] = 255;
-                rgb[B] = 255;
+        if (buf->n == 0) {
+                strip_apply_all((RGB_ptr_t) off);
+                return;
         }
-        
-        if (strip_breathe(rgb, delay_ms, step_size)) {
-                rgb[R] = (rand() % 256);
-                rgb[G] = (rand() % 256);
-                rgb[B] = (rand() % 256);
+
+        frame_sig_begin();
+        for (uint16_t px_i = 0; px_i < buf->size; px_i++) {
+                if (pxbuf_used(buf, px_i))
+                        frame_sig_px(buf->buf[px_i].rgb, buf->buf[px_i].pos);
         }
+        frame_sig_run(off, strip_size);
+
+        src.px = buf;
+        frame_submit(tx_pxbuf, &src, prep_pxbuf);
 }
 
-/* strip_breathe_rainbow
- * ---------------------
+/* strip_apply_pxgen
+ * -----------------
  * Parameters:
- *      breath_step_size - Brightness steps during breath.
- *      rgb_step_size - Color steps.
+ *      gen - Pixel generator, see pxgen_t for its cycle budget
  * Description:
- *      Gradiently "Breathes" trough the rgb spectrum
+ *      Renders the strip from a pixel generator. If the frame
+ *      arena can hold the frame, it is generated up front and
+ *      applied as a RGB buffer (see strip_apply_RGBbuf). Otherwise
+ *      the pixels are generated while the frame is transmitted,
+ *      so strips of any length can be driven with a constant
+ *      amount of memory. Such frames cannot be compared to the
+ *      previous frame up front and are therefore always
+ *      transmitted, and since the output stage does not fit
+ *      between two pixels, they are sent as off below full
+ *      brightness or with GAMMA_CORRECTION set.
  */
-void strip_breathe_rainbow(uint16_t delay_ms, uint8_t breath_step_size, uint8_t rgb_step_size)
+static bool prep_pxgen(frame_src *src)
 {
-        static RGB_t rgb = {255, 0, 0};
+        uint32_t t;
+        RGB_t px;
+
+        if (!out_identity())
+                return false;
+
+        // Generators compute pixels from i alone and
+        // may be pulled more than once per frame
+        t = clock_us();
+        for (uint8_t i = 0; i < STRIP_PX_SAMPLES; i++) {
+                src->gen.fn(i, px);
+                tx_sink = px[R] ^ px[G] ^ px[B];
+        }
+        src->gen.cycles = tx_cycles_per_px(t);
 
-        if (strip_breathe(rgb, delay_ms, breath_step_size))
-                rgb_apply_fade(rgb, rgb_step_size);
+        return true;
 }
 
-#if STRIP_TYPE == WS2812
+static uint16_t tx_pxgen(const frame_src *src, uint16_t start, uint16_t n, bool rev)
+{
+        uint16_t len = tx_len(strip_size, start, n);
 
-/* strip_rotate_rainbow
- * --------------------
- *  * Parameters:
- *      step_size - Color steps between each pixel
- * Description:
- *      Rotates the rgb spectrum across the strip.
- *      Unlike other RGB fade effects, this one doesn't 
- *      allow for changes in speed, as the addition of delays, 
- *      changes in step size, and even just additional code can
- *      easily lead to uncomfortable lag.
- */
-void strip_rotate_rainbow(uint8_t step_size, uint16_t delay_ms)
+        if (rev)
+                ws2812_tx_run(off, n - len);
+
+        tx_stall += (uint32_t) len * src->gen.cycles;
+        strip_tx_pxgen(src->gen.fn, start, len, rev);
+        return rev ? n : len;
+}
+
+void strip_apply_pxgen(pxgen_t gen)
 {
-        static RGB_t rgb = {255, 0 , 0};
-        
-        if (ms_passed() < delay_ms)
+        RGBbuf buf = (RGBbuf) strip_arena_alloc(sizeof(RGB_t) * strip_size);
+        frame_src src;
+
+        if (buf) {
+                for (uint16_t i = 0; i < strip_size; i++)
+                        gen(i, buf[i]);
+
+                strip_apply_RGBbuf(buf);
                 return;
+        }
 
-        rgb_apply_fade(rgb, step_size);
+        frame_sig_begin();
+        frame_sig_invalidate();
 
-        RGB_t tmp;
-        rgb_cpy(tmp, rgb);
+#ifdef POWER_LIMITER
+#ifdef ZONES
+        power_gen *pg = &power_gens[zone_cur];
+#else
+        power_gen *pg = &power_gens[0];
+#endif
 
-        ws2812_prep_tx();
-                for (uint16_t i = 0; i < strip_size; i++) {
-                        ws2812_tx_byte(tmp[WS2812_WIRING_RGB_0]);
-                        ws2812_tx_byte(tmp[WS2812_WIRING_RGB_1]);
-                        ws2812_tx_byte(tmp[WS2812_WIRING_RGB_2]);
-                        rgb_apply_fade(tmp, step_size);
-                }
-        ws2812_end_tx();
+        if (pg->gen != gen) {
+                pg->gen = gen;
+                pg->load = (uint32_t) 765 * strip_size;
+        }
+        power_load = pg->load;
+        src.gen.pg = pg;
+#endif
 
-        reset_timer();
+        src.gen.fn = gen;
+        frame_submit(tx_pxgen, &src, prep_pxgen);
 }
 
-/* strip_apply_RGBbuf
- * ------------------
+/* rain_step
+ * ---------
  * Parameters:
- *      pxbuf - Pixel buffer to be applied across the LED strip
+ *      in - Input frame of the current main loop iteration
+ *      buf - Pixel buffer of the droplets
+ *      rgb - RGB value of rain droplets
+ *      max_drops - Maximum amount of visible "droplets" at a time
+ *      min_t_appart - Minimum time in ms between drops
+ *      max_t_appart - Maximum time in ms between drops
+ *      dealy - Delay of droplet fading
+ * Returns:
+ *      true - Droplets have changed
+ *      false - Droplets are unchanged
  * Description:
- *      Applies a pixel buffer across the LED strip.
+ *      Fades the droplets of a rain effect and spawns new ones.
  */
-void strip_apply_pxbuf(pxbuf *buf)
+static bool rain_step(const input_frame *in, pxbuf *buf, RGB_t rgb, uint16_t max_drops, uint16_t min_t_appart, uint16_t max_t_appart, uint16_t delay)
 {
-        uint16_t px_i;
+        uint16_t pos;
+        bool t_passed;
+        bool changed = false;
 
-        if (buf->size == 0) {
-                strip_apply_all((RGB_ptr_t) off);
-                return;
-        }
+        // Droplets fade on TMR_ANIM, new droplets spawn on TMR_ANIM_AUX
+        t_passed = timer_elapsed(TMR_ANIM, in->ms) >= delay;
+
+        for (uint16_t i = 0; i < buf->size; i++) {
+                if (!pxbuf_used(buf, i))
+                        continue;
 
-        px_i = 0;
+                if (buf->buf[i].rgb[R] == 0 && buf->buf[i].rgb[G] == 0 && buf->buf[i].rgb[B] == 0) {
+                        pxbuf_remove(buf, i);
+                        changed = true;
+                } else if (t_passed) {
+                        for (uint8_t c = 0; c < 3; c++) {
+                                color_t *ch = &buf->buf[i].rgb[c];
+                                *ch = (*ch > COLOR8(1)) ? *ch - COLOR8(1) : 0;
+                        }
+                        changed = true;
+                }
+        }
         
-        ws2812_prep_tx();
-        for (uint16_t i = 0; i < strip_size; i++) {
-                if (px_i < buf->size && i == buf->buf[px_i].pos) {
-                        ws2812_tx_byte(buf->buf[px_i].rgb[WS2812_WIRING_RGB_0]);
-                        ws2812_tx_byte(buf->buf[px_i].rgb[WS2812_WIRING_RGB_1]);
-                        ws2812_tx_byte(buf->buf[px_i].rgb[WS2812_WIRING_RGB_2]);
-                        px_i++;
-                } else {
-                        ws2812_tx_byte(0);
-                        ws2812_tx_byte(0);
-                        ws2812_tx_byte(0); 
+        if (t_passed)
+                timer_reset(TMR_ANIM, in->ms);
+
+        t_passed = timer_elapsed(TMR_ANIM_AUX, in->ms) >= (rand() % (max_t_appart - min_t_appart + 1)) + min_t_appart;
+
+        if (t_passed && buf->n < max_drops) {
+                pos = rand() % strip_size;
+
+                if (!pxbuf_exists(buf, pos) && pxbuf_insert(buf, pos, rgb)) {
+                        timer_reset(TMR_ANIM_AUX, in->ms);
+                        changed = true;
                 }
         }
-        ws2812_end_tx();
+
+        return changed;
 }
 
 /* strip_rain
  * ----------
  * Parameters:
+ *      in - Input frame of the current main loop iteration
  *      rgb - RGB value of rain droplets
  *      max_drops - Maximum amount of visible "droplets" at a time
  *      min_t_appart - Minimum time in ms between drops
@@ -815,102 +3398,173 @@ void strip_apply_pxbuf(pxbuf *buf)
  *      dealy - Delay of droplet fading
  * Description:
  *      Creates a rain effect across the strip.
- *      Note that this effect makes use of an RGB buffer and will linearly increase 
- *      memory consumption with strip size. 
+ *      Droplets are held in a pixel buffer, so at most PXBUF_SIZE
+ *      droplets are visible at a time.
  */
-void strip_rain(RGB_t rgb, uint16_t max_drops, uint16_t min_t_appart, uint16_t max_t_appart, uint16_t delay)
+void strip_rain(const input_frame *in, RGB_t rgb, uint16_t max_drops, uint16_t min_t_appart, uint16_t max_t_appart, uint16_t delay)
 {
-        static pxbuf pxbuf = {
-                .size = 0,
-                .buf = NULL
-        };
+        FX_STATE(pxbuf, drops); // Zero initialized, that is empty
+
+        rain_step(in, &drops, rgb, max_drops, min_t_appart, max_t_appart, delay);
+        strip_apply_pxbuf(&drops);
+}
 
-        static uint16_t wait_until = 0;
+#ifdef COMPOSITE_PIXELS
 
-        uint16_t ms;
-        uint16_t pos;
-        bool t_passed;
+/* strip_rain_over_rainbow
+ * -----------------------
+ * Parameters:
+ *      in - Input frame of the current main loop iteration
+ *      rgb - RGB value of rain droplets
+ *      max_drops - Maximum amount of visible "droplets" at a time
+ *      min_t_appart - Minimum time in ms between drops
+ *      max_t_appart - Maximum time in ms between drops
+ *      dealy - Delay of droplet fading
+ *      step_size - Color steps between each pixel of the rainbow
+ *      rainbow_delay_ms - Delay in ms between each step of the rainbow
+ * Description:
+ *      Creates a rain effect over a rotating rainbow. The droplets
+ *      are added onto the rainbow in a composite of COMPOSITE_PIXELS
+ *      pixels, so frames in which the rainbow doesn't move only
+ *      recompose the pixels between the first and the last droplet.
+ *      Pixels beyond COMPOSITE_PIXELS are off.
+ */
+static hue_t rain_rainbow_hue;
+static uint8_t rain_rainbow_step;
 
-        t_passed = ms_passed() >= wait_until;
+static void rain_rainbow_gen(uint16_t i, RGB_ptr_t rgb)
+{
+        hsv2rgb(hue_add(rain_rainbow_hue, hue_mul(i, rain_rainbow_step)), 255, 255, rgb);
+}
 
-        for (uint16_t i = 0; i < pxbuf.size; i++) {
-                if (pxbuf.buf[i].rgb[R] == 0 && pxbuf.buf[i].rgb[G] == 0 && pxbuf.buf[i].rgb[B] == 0) {
-                        pxbuf_remove(&pxbuf, i);
-                } else if (t_passed) {
-                        if (pxbuf.buf[i].rgb[R] != 0)
-                                pxbuf.buf[i].rgb[R]--;
-                        if (pxbuf.buf[i].rgb[G] != 0)
-                                pxbuf.buf[i].rgb[G]--;
-                        if (pxbuf.buf[i].rgb[B] != 0)
-                                pxbuf.buf[i].rgb[B]--;                        
-                }
+/* pxbuf_span
+ * ----------
+ * Parameters:
+ *      buf - Pointer to a pixel buffer
+ *      start - Position of the first pixel
+ *      end - Position after the last pixel
+ * Description:
+ *      Determines the range covered by the pixels of a pixel
+ *      buffer. The range is empty if the buffer is empty.
+ */
+static void pxbuf_span(pxbuf *buf, uint16_t *start, uint16_t *end)
+{
+        uint16_t first = 0;
+        uint16_t last = buf->size;
+
+        while (first < buf->size && !pxbuf_used(buf, first))
+                first++;
+
+        while (last > first && !pxbuf_used(buf, last - 1))
+                last--;
+
+        *start = *end = 0;
+
+        if (first < last) {
+                *start = buf->buf[first].pos;
+                *end = buf->buf[last - 1].pos + 1;
         }
-        
-        if (t_passed)
-                wait_until = ms_passed() + delay;
+}
 
-        t_passed = ms_passed() >= (rand() % (max_t_appart - min_t_appart + 1)) + min_t_appart;
+void strip_rain_over_rainbow(const input_frame *in, RGB_t rgb, uint16_t max_drops, uint16_t min_t_appart, uint16_t max_t_appart, uint16_t delay, uint8_t step_size, uint16_t rainbow_delay_ms)
+{
+        FX_STATE_ARRAY(RGB_t, frame, COMPOSITE_PIXELS);
+        FX_STATE(pxbuf, drops);
+        FX_STATE_ARRAY(layer, layers, 2);
+        FX_STATE(composite, comp);
+        FX_STATE(hue_t, hue);
+        FX_STATE(uint8_t, step);
+        FX_STATE(uint16_t, acc);
+
+        uint16_t size = (strip_size < COMPOSITE_PIXELS) ? strip_size : COMPOSITE_PIXELS;
+        uint16_t steps = anim_steps(&acc, in->dt, rainbow_delay_ms);
+        uint16_t start, end;
 
-        if (t_passed && pxbuf.size < max_drops) {
-                pos = rand() % strip_size;
+        if (step_size == 0)
+                step_size = 1;
 
-                if (!pxbuf_exists(&pxbuf, pos)) {
-                        pxbuf_insert(&pxbuf, pos, rgb);
-                        ms = ms_passed();
-                        
-                        if (ms < wait_until)
-                                wait_until -= ms;
-                        else
-                                wait_until = 0; // Already passed 
+        if (comp.size != size) {
+                layers[0].type = LAYER_GEN;
+                layers[0].src.gen = rain_rainbow_gen;
 
-                        reset_timer();   
-                }
+                layers[1].type = LAYER_PXBUF;
+                layers[1].blend = BLEND_ADD;
+                layers[1].src.px = &drops;
+
+                composite_init(&comp, frame, size, layers, 2);
+        }
+
+        if (steps || step_size != step) {
+                hue = hue_add(hue, hue_mul(steps, step_size));
+                step = step_size;
+                layer_dirty(&layers[0], 0, size);
+        }
+
+        // The generator is pulled while the composite is updated
+        rain_rainbow_hue = hue;
+        rain_rainbow_step = step;
+
+        // Droplets that fade out or spawn lie within
+        // the span of the droplets before or after the step
+        pxbuf_span(&drops, &start, &end);
+        if (rain_step(in, &drops, rgb, max_drops, min_t_appart, max_t_appart, delay)) {
+                layer_dirty(&layers[1], start, end);
+                pxbuf_span(&drops, &start, &end);
+                layer_dirty(&layers[1], start, end);
         }
 
-        strip_apply_pxbuf(&pxbuf);
+        strip_apply_composite(&comp);
 }
 
-bool strip_override(RGB_t rgb, uint16_t delay)
+#endif
+
+bool strip_override(const input_frame *in, RGB_t rgb, uint16_t delay)
 {
 
-        static uint16_t pos = 0;
+        FX_STATE(uint16_t, pos);
+        FX_STATE_ARRAY(substrp, substrps, 2); // Zero initialized, the first color overrides off
+        substrpbuf buf = {2, substrps};
 
         if (pos == strip_size) {
+                // The next color overrides this one
+                color_set(substrps[1].rgb, rgb);
                 pos = 0;
                 return true;
         }
 
-        if (ms_passed() < delay)
+        if (timer_elapsed(TMR_ANIM, in->ms) < delay)
                 return false;
-        
-        ws2812_prep_tx();        
-        for (uint16_t i = 0; i <= pos; i++) {
-                ws2812_tx_byte(rgb[WS2812_WIRING_RGB_0]);
-                ws2812_tx_byte(rgb[WS2812_WIRING_RGB_1]);
-                ws2812_tx_byte(rgb[WS2812_WIRING_RGB_2]);
-        }
-        ws2812_end_tx();
+
+        // Frames always cover the entire strip, as mapped
+        // and zoned frames are padded with off otherwise
+        substrps[0].length = pos + 1;
+        color_set(substrps[0].rgb, rgb);
+        substrps[1].length = strip_size - pos - 1;
+        strip_apply_substrpbuf(buf);
 
         pos++;
 
-        reset_timer();
+        timer_reset(TMR_ANIM, in->ms);
         return false;
 }
 
-void strip_override_array(RGB_t rgb[], uint8_t size, uint16_t delay)
+void strip_override_array(const input_frame *in, RGB_t rgb[], uint8_t size, uint16_t delay)
 {
-        static uint8_t i = 0;
+        FX_STATE(uint8_t, i);
 
-        if (strip_override(rgb[i], delay))
+        if (strip_override(in, rgb[i], delay))
                 i = (i + 1) % size;
 }
 
-void strip_override_rainbow(uint16_t delay, uint8_t step_size)
+void strip_override_rainbow(const input_frame *in, uint16_t delay, uint8_t step_size)
 {
-        static RGB_t rgb = {255, 0, 0};
+        FX_STATE(hue_t, hue);
+
+        RGB_t rgb;
 
-        if (strip_override(rgb, delay))
-                rgb_apply_fade(rgb, step_size);
+        hsv2rgb(hue, 255, 255, rgb);
+        if (strip_override(in, rgb, delay))
+                hue = hue_add(hue, step_size ? step_size : 1);
 }
 
 #endif
\ No newline at end of file
@@ -27,6 +27,7 @@
 #include <avr/eeprom.h>
 
 #include "config.h"
+#include "input.h"
 
 #define R 0
 #define G 1
@@ -37,6 +38,24 @@
 #define BRG 2
 #define BGR 3
 
+#define MAP_NONE 0
+#define MAP_REVERSE 1
+#define MAP_MIRROR 2
+#define MAP_TILE 3
+#define MAP_SERPENTINE 4
+
+#ifndef STRIP_MAP
+#define STRIP_MAP MAP_NONE
+#endif
+
+#if STRIP_MAP == MAP_TILE && !(defined(STRIP_MAP_TILES) && STRIP_MAP_TILES > 0)
+#error "MAP_TILE requires the number of tiles! Please set the STRIP_MAP_TILES directive in the config file!"
+#endif
+
+#if STRIP_MAP == MAP_SERPENTINE && !(defined(STRIP_MAP_WIDTH) && STRIP_MAP_WIDTH > 0)
+#error "MAP_SERPENTINE requires the matrix width! Please set the STRIP_MAP_WIDTH directive in the config file!"
+#endif
+
 #if STRIP_TYPE == WS2812
 
         extern uint16_t eeprom_strip_size EEMEM;
@@ -117,6 +136,27 @@
 typedef uint8_t RGB_t[3];
 typedef uint8_t* RGB_ptr_t;
 
+/* color_t
+ * ----------
+ * Description:
+ *      Working precision of a color channel in substrip
+ *      and pixel buffers. With COLOR_16BIT set, channels are
+ *      stored with 16 bits and are only reduced to 8 bits by
+ *      the output stage, so chained operations (brightness,
+ *      decays) don't accumulate rounding errors. This doubles
+ *      the memory of the color values in substrip and pixel
+ *      buffers (6 instead of 3 bytes each).
+ *
+ *      Use COLOR8 to assign 8-bit values to a color_t.
+ */
+#ifdef COLOR_16BIT
+typedef uint16_t color_t;
+#define COLOR8(v) ((color_t) ((v) * 257))
+#else
+typedef uint8_t color_t;
+#define COLOR8(v) ((color_t) (v))
+#endif
+
 /* RGBbuf
  * ----------
  * Description:
@@ -152,7 +192,7 @@ typedef RGB_t* RGBbuf;
  */
 typedef struct substrp {
         uint16_t length;
-        RGB_t rgb;
+        color_t rgb[3];
 } substrp;
 
 /* substrpbuf
@@ -162,11 +202,12 @@ typedef struct substrp {
  *      in their indexed order. If the substrips do
  *      not cover the entire strip, the remaining
  *      pixels are set to off.
- *      Must be allocated first!
+ *      Must be allocated first, either statically
+ *      or from the frame arena (see strip_arena_alloc)!
  * 
  *      Also see:
  *              substrpbuf_cpy
- *              substrpbuf_free
+ *              strip_arena_alloc
  *            
  */
 typedef struct substrpbuf {
@@ -179,11 +220,14 @@ typedef struct substrpbuf {
  * Description:
  *      Addresses a pixel at any given position (pos)
  *      and sets its color to the provided RGB value (rgb).
+ *      The output color (out) is set by the strip before
+ *      the pixel is sent and must not be used otherwise.
  *            
  */
 typedef struct pxl {
         uint16_t pos;
-        RGB_t rgb;
+        color_t rgb[3];
+        RGB_t out;
 } pxl;
 
 /* pxlbuf
@@ -192,6 +236,19 @@ typedef struct pxl {
  *      Buffer of pxl objects. Allows one to address
  *      pixels individually without having to allocate
  *      memory for unused pixels.
+ *
+ *      Pixels are kept sorted by position in a fixed pool
+ *      of PXBUF_SIZE slots, so pixel buffers never touch
+ *      the heap. Removed pixels only leave a mark in the
+ *      removed bitmap, and their slot is reused by later
+ *      insertions. Slots must therefore be checked with
+ *      pxbuf_used when iterating over buf.
+ *
+ *      Lookups are a binary search and removals only set a bit,
+ *      insertions shift slots up to the nearest free one.
+ *      test/test_pxbuf fuzzes the pool against a std::map and
+ *      test/test_pxbuf_bench times it against the heap-backed
+ *      buffer it replaced, both on the host, not on hardware.
  *      
  *      The following helper functions should be used
  *      when working with pixel buffers:
@@ -199,49 +256,358 @@ typedef struct pxl {
  *              pxbuf_init
  *              pxbuf_insert
  *              pxbuf_exists
+ *              pxbuf_used
  *              pxbuf_remove
  *              pxbuf_remove_at
  *                 
  */
+#ifndef PXBUF_SIZE
+#define PXBUF_SIZE 32
+#endif
+
 typedef struct pxbuf {
-        uint16_t size;
-        pxl* buf;
+        uint16_t size;                            // Number of slots in use, including removed pixels
+        uint16_t n;                               // Number of pixels
+        uint8_t removed[(PXBUF_SIZE + 7) / 8];    // Bitmap of removed slots
+        pxl buf[PXBUF_SIZE];
 } pxbuf;
 
+/* pxbuf_used
+ * ----------
+ * Parameters:
+ *      buf - Pointer to a pixel buffer
+ *      index - Slot index (NOT POSITION!)
+ * Returns:
+ *      true - The slot holds a pixel
+ *      false - The pixel of the slot has been removed
+ */
+static inline bool pxbuf_used(const pxbuf *buf, uint16_t index)
+{
+        return !(buf->removed[index >> 3] & (1 << (index & 7)));
+}
+
+/* palbuf
+ * ----------
+ * Description:
+ *      Palettised frame buffer. Every pixel is stored as a 4-bit
+ *      or 2-bit index into a palette of up to PALETTE_SIZE colors,
+ *      which is expanded while the buffer is sent. Compared to
+ *      a RGB buffer, this reduces the memory of a 600 pixel strip
+ *      from 1800 to 300 (4-bit) or 150 (2-bit) bytes.
+ *
+ *      PALETTE_SIZE follows PALBUF_BITS of the config file, which
+ *      defaults to 2 bits on ATtinys, so the buffer itself takes
+ *      27 bytes with 2 bits and 87 bytes with 4 bits (39 and 135
+ *      with COLOR_16BIT). The palette after the output stage is
+ *      only kept in the frame arena while the buffer is sent.
+ *
+ *      The index storage must be allocated first, statically or
+ *      from the frame arena, with PALBUF_BYTES(size, bits) bytes.
+ *      Pixels beyond the size of the buffer are set to off.
+ *
+ *      The number of pixels per index is kept up to date
+ *      by palbuf_set, so palette changes, such as palette
+ *      cycling (see palbuf_cycle), are signed and power
+ *      limited in O(palette) rather than O(pixels).
+ *
+ *      The following helper functions should be used
+ *      when working with palettised buffers:
+ *
+ *              palbuf_init
+ *              palbuf_get
+ *              palbuf_set
+ *              palbuf_cycle
+ */
+#ifndef PALBUF_BITS
+#if defined(__AVR_ATtiny25__) || defined(__AVR_ATtiny45__) || defined(__AVR_ATtiny85__)
+#define PALBUF_BITS 2
+#else
+#define PALBUF_BITS 4
+#endif
+#endif
+
+#if PALBUF_BITS != 2 && PALBUF_BITS != 4
+#error "PALBUF_BITS must be 2 or 4! Please correct it in the config file!"
+#endif
+
+#define PALETTE_SIZE (1 << PALBUF_BITS)
+#define PALBUF_BYTES(size, bits) (((uint32_t) (size) * (bits) + 7) / 8)
+
+typedef struct palbuf {
+        uint16_t size;                            // Number of pixels
+        uint8_t bits;                             // Bits per index, 2 or PALBUF_BITS
+        uint16_t gen;                             // Incremented whenever an index changes
+        uint16_t count[PALETTE_SIZE];             // Number of pixels per index
+        color_t palette[PALETTE_SIZE][3];
+        uint8_t *idx;                             // Packed indices, lowest bits first
+} palbuf;
+
+/* palbuf_get
+ * ----------
+ * Parameters:
+ *      buf - Pointer to a palettised buffer
+ *      pos - Position of the pixel
+ * Returns:
+ *      Palette index of the pixel
+ */
+static inline uint8_t palbuf_get(const palbuf *buf, uint16_t pos)
+{
+        uint8_t byte;
+
+        if (buf->bits == 4) {
+                byte = buf->idx[pos >> 1];
+                return (pos & 1) ? byte >> 4 : byte & 0x0F;
+        }
+
+        byte = buf->idx[pos >> 2];
+        return (byte >> ((pos & 3) << 1)) & 0x03;
+}
+
+/* zone
+ * ----------
+ * Description:
+ *      Range of the strip that is rendered by its own patch,
+ *      see ZONES in the config file. Zones are described with
+ *      the ZONE(start, length, patch) macro. The patch is an
+ *      index of the patch list, or ZONE_SELECTED for the patch
+ *      selected by the push button. Patches keep their state
+ *      in static variables, so every patch may only be listed
+ *      once, see zone_patch_fixed. The effects they call keep
+ *      their state once per zone, so different patches may run
+ *      the same effect.
+ */
+#ifdef ZONES
+
+#if STRIP_TYPE != WS2812
+#error "Zones require an addressable (WS2812) strip!"
+#endif
+
+typedef struct zone {
+        uint16_t start;
+        uint16_t length;
+        uint8_t patch;
+} zone;
+
+#define ZONE_SELECTED 0xFF
+
+// Every entry of ZONES counts as one zone
+#define ZONE(start, length, patch) + 1
+enum { NUM_ZONES = 0 ZONES };
+#undef ZONE
+
+#define ZONE(start, length, patch) {start, length, patch},
+
+extern const zone zones[];
+extern const uint8_t num_zones;
+
+#endif
+
+/* pxgen_t
+ * ----------
+ * Description:
+ *      Pixel generator. Writes the color of pixel i
+ *      into rgb. Generators are pulled once per pixel and
+ *      in ascending order, into the frame arena if it can
+ *      hold the frame, else by the transmit loop (see
+ *      strip_apply_pxgen), so effects can be computed on the
+ *      fly without allocating a buffer for the strip.
+ *      With a STRIP_MAP set, pixels may be pulled in
+ *      descending order or more than once per frame, so
+ *      generators should compute pixels from i alone.
+ *
+ *      Streamed generators run while interrupts are disabled and
+ *      the strip waits for the next pixel. Everything between two
+ *      pixels, that is the generator, the power accounting (if POWER_LIMIT_MA is set) and the
+ *      call overhead, must fit into WS2812_MAX_GAP_CYCLES
+ *      (80 cycles at 16 MHz), else the strip latches early.
+ *      Keep generators to a few table lookups or additions.
+ *
+ *      The output stage (brightness, dithering and gamma
+ *      correction) is applied before interrupts are disabled:
+ *      runs, substrips, pixel buffers and palettes are passed
+ *      trough it once per color, RGB buffers and generated frames
+ *      that fit into the frame arena are copied trough it, and
+ *      composites trough a table of all 256 channel values. The
+ *      rotating rainbow steps its output colors by additions only.
+ *      Streamed generators leave no room for it, so their frames
+ *      are sent as off below full brightness or with
+ *      GAMMA_CORRECTION set.
+ */
+typedef void (*pxgen_t)(uint16_t i, RGB_ptr_t rgb);
+
+/* layer
+ * ----------
+ * Description:
+ *      Layer of a composited frame (see composite). The pixels
+ *      of a layer are pulled from a pixel generator (LAYER_GEN),
+ *      which must compute pixels from i alone, or from a pixel
+ *      buffer (LAYER_PXBUF), whose unassigned pixels are transparent.
+ *
+ *      Overlays are blended onto the layers below with one of:
+ *              BLEND_ADD - Channels are added, saturating at 255
+ *              BLEND_MAX - The brighter value of every channel is kept
+ *              BLEND_ALPHA - The layer is laid over with an opacity of alpha
+ *              BLEND_MULTIPLY - The layers below are scaled by the layer
+ *      The blend of the base layer is ignored, it is copied as is.
+ *
+ *      Every layer keeps a dirty range of pixels that changed since
+ *      the last composition. Layers must mark their changes with
+ *      layer_dirty, only dirty ranges are recomposed.
+ *
+ *      Layers are pulled while the frame is composed, before it is
+ *      sent, so their generators are not bound by the cycle budget
+ *      of the transmit loop.
+ */
+#define LAYER_GEN 0
+#define LAYER_PXBUF 1
+
+#define BLEND_ADD 0
+#define BLEND_MAX 1
+#define BLEND_ALPHA 2
+#define BLEND_MULTIPLY 3
+
+typedef struct layer {
+        uint8_t type;                             // LAYER_GEN or LAYER_PXBUF
+        uint8_t blend;
+        uint8_t alpha;                            // Opacity of BLEND_ALPHA (0 - 255)
+        uint16_t dirty_start;                     // Dirty range [dirty_start, dirty_end),
+        uint16_t dirty_end;                       // empty if dirty_start >= dirty_end
+        union {
+                pxgen_t gen;
+                pxbuf *px;
+        } src;
+} layer;
+
+/* composite
+ * ----------
+ * Description:
+ *      Frame composed of a base layer (layers[0]) and overlays,
+ *      blended in ascending order. The composed frame is kept in
+ *      a RGB buffer, and only the dirty ranges of the layers are
+ *      blended again when the frame is applied (see
+ *      strip_apply_composite). A slow base layer with a sparse
+ *      overlay, such as rain over a rainbow, is therefore
+ *      recomposed in a few pixels per frame.
+ *
+ *      Requires COMPOSITE_PIXELS to be set in the config file.
+ *      The RGB buffer (3 bytes per pixel) must be allocated first,
+ *      statically or from the frame arena. Pixels beyond the size of
+ *      the composite are set to off.
+ *
+ *      The following helper functions should be used
+ *      when working with composites:
+ *
+ *              composite_init
+ *              layer_dirty
+ */
+#ifdef COMPOSITE_PIXELS
+
+#if defined(__AVR_ATtiny25__) || defined(__AVR_ATtiny45__) || defined(__AVR_ATtiny85__)
+#error "Compositing requires an ATmega328 or a MCU with more RAM! Please comment out COMPOSITE_PIXELS in the config file!"
+#endif
+
+typedef struct composite {
+        uint16_t size;                            // Number of pixels
+        uint16_t gen;                             // Incremented whenever a pixel is recomposed
+        uint8_t n_layers;
+        layer *layers;                            // Base layer, followed by the overlays
+        RGBbuf buf;                               // Composed frame
+#if defined(POWER_LIMIT_MA) && POWER_LIMIT_MA > 0
+        uint32_t load;                            // Load of the composed frame, see power_run
+#endif
+} composite;
+
+/* layer_dirty
+ * ----------
+ * Parameters:
+ *      l - Pointer to a layer
+ *      start - First pixel that changed
+ *      end - Pixel after the last pixel that changed
+ * Description:
+ *      Extends the dirty range of a layer by [start, end).
+ */
+static inline void layer_dirty(layer *l, uint16_t start, uint16_t end)
+{
+        if (start >= end)
+                return;
+
+        if (l->dirty_start >= l->dirty_end) {
+                l->dirty_start = start;
+                l->dirty_end = end;
+                return;
+        }
+
+        if (start < l->dirty_start)
+                l->dirty_start = start;
+        if (end > l->dirty_end)
+                l->dirty_end = end;
+}
+
+#endif
+
 void rgb_apply_brightness(RGB_t rgb, uint8_t brightness);
+void strip_set_brightness(uint8_t brightness);
 void substripbuf_apply_brightness(substrpbuf *strp, uint8_t brightness);
 
-void substrpbuf_cpy(substrpbuf *dst, substrpbuf *src);
-void substrpbuf_free(substrpbuf *strp);
 
 void pxbuf_init(pxbuf *buf);
-void pxbuf_insert(pxbuf *buf, uint16_t pos, RGB_t rgb);
+bool pxbuf_insert(pxbuf *buf, uint16_t pos, RGB_t rgb);
 bool pxbuf_exists(pxbuf *buf, uint16_t pos);
 void pxbuf_remove(pxbuf *buf, uint16_t index);
 bool pxbuf_remove_at(pxbuf *buf, uint16_t pos);
 
+void palbuf_init(palbuf *buf, uint8_t *idx, uint16_t size, uint8_t bits);
+void palbuf_set(palbuf *buf, uint16_t pos, uint8_t index);
+void palbuf_cycle(palbuf *buf, uint8_t first, uint8_t n);
+
+#ifdef COMPOSITE_PIXELS
+void composite_init(composite *c, RGBbuf buf, uint16_t size, layer *layers, uint8_t n_layers);
+#endif
+
 void strip_apply_all(RGB_ptr_t rgb);
 
 #if STRIP_TYPE == WS2812
+void *strip_arena_alloc(uint16_t size);
+void strip_arena_reset();
+bool substrpbuf_cpy(substrpbuf *dst, substrpbuf *src);
+
+bool strip_tx_skipped();
+void strip_frame_begin();
+void strip_frame_end();
+#ifdef ZONES
+bool strip_zone_begin(uint8_t z);
+bool zone_patch_fixed(uint8_t patch);
+#endif
 void strip_calibrate();
 void strip_apply_substrpbuf(substrpbuf strp);
 void strip_apply_RGBbuf(RGBbuf RGBbuf);
 void strip_apply_pxbuf(pxbuf *buf);
+void strip_apply_pxgen(pxgen_t gen);
+void strip_apply_palbuf(palbuf *buf);
+#ifdef COMPOSITE_PIXELS
+void strip_apply_composite(composite *c);
+#endif
 void strip_distribute_rgb(RGB_t rgb[], uint16_t size);
 #endif
 
 void strip_scroll_rgb(uint16_t val, uint8_t brightness);
-bool strip_fade(RGB_ptr_t rgb, uint16_t delay_ms, uint8_t step_size, bool start);
-bool strip_breathe(RGB_ptr_t rgb, uint16_t delay_ms, uint8_t step_size);
-void strip_breathe_array(RGB_t rgb[], uint8_t size, uint16_t delay_ms, uint8_t step_size);
-void strip_breathe_random(uint16_t delay_ms, uint8_t step_size);
-void strip_breathe_rainbow(uint16_t delay_ms, uint8_t breath_step_size, uint8_t rgb_step_size);
-void strip_rainbow(uint8_t step_size, uint16_t delay, uint8_t brightness);
+bool strip_fade(const input_frame *in, RGB_ptr_t rgb, uint16_t delay_ms, uint8_t step_size, bool start);
+bool strip_breathe(const input_frame *in, RGB_ptr_t rgb, uint16_t delay_ms, uint8_t step_size);
+void strip_breathe_array(const input_frame *in, RGB_t rgb[], uint8_t size, uint16_t delay_ms, uint8_t step_size);
+void strip_breathe_random(const input_frame *in, uint16_t delay_ms, uint8_t step_size);
+void strip_breathe_rainbow(const input_frame *in, uint16_t delay_ms, uint8_t breath_step_size, uint8_t rgb_step_size);
+void strip_rainbow(const input_frame *in, uint8_t step_size, uint16_t delay, uint8_t brightness);
 
 #if STRIP_TYPE == WS2812
-void strip_rotate_rainbow(uint8_t step_size, uint16_t delay_ms);
-void strip_rain(RGB_t rgb, uint16_t max_drops, uint16_t min_t_appart, uint16_t max_t_appart, uint16_t delay);
-bool strip_override(RGB_t rgb, uint16_t delay);
-void strip_override_array(RGB_t rgb[], uint8_t size, uint16_t delay);
-void strip_override_rainbow(uint16_t delay, uint8_t step_size);
+void strip_rotate_rainbow(const input_frame *in, uint8_t step_size, uint16_t delay_ms);
+#ifdef PALBUF_PIXELS
+void strip_cycle_rainbow(const input_frame *in, uint16_t band_width, uint16_t delay_ms);
+#endif
+#ifdef COMPOSITE_PIXELS
+void strip_rain_over_rainbow(const input_frame *in, RGB_t rgb, uint16_t max_drops, uint16_t min_t_appart, uint16_t max_t_appart, uint16_t delay, uint8_t step_size, uint16_t rainbow_delay_ms);
+#endif
+void strip_rain(const input_frame *in, RGB_t rgb, uint16_t max_drops, uint16_t min_t_appart, uint16_t max_t_appart, uint16_t delay);
+bool strip_override(const input_frame *in, RGB_t rgb, uint16_t delay);
+void strip_override_array(const input_frame *in, RGB_t rgb[], uint8_t size, uint16_t delay);
+void strip_override_rainbow(const input_frame *in, uint16_t delay, uint8_t step_size);
 #endif
\ No newline at end of file
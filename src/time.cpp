@@ -22,61 +22,349 @@
 
 #include <avr/io.h>
 #include <avr/interrupt.h>
+#include <avr/sleep.h>
+#include <util/atomic.h>
 
 #ifdef ARDUINO_BUILD
 #include <Arduino.h>
 #endif
 
+#include "config.h"
 #include "time.h"
 
-#ifdef ARDUINO_BUILD
+#ifdef ZONES
+#include "strip.h"
+#define NUM_TIMER_BANKS NUM_ZONES
+#else
+#define NUM_TIMER_BANKS 1
+#endif
+
+#if defined(FRAME_RATE) && FRAME_RATE > 0
+#define FRAME_TIME_US (1000000UL / FRAME_RATE)
+#endif
+
+uint16_t frame_dt = 0;       // Time in ms passed between the previous and the current frame
+static uint16_t frame_drops = 0; // Number of frames that could not be rendered in time
 
-unsigned long start = millis();
+// Software timers, one bank per zone
+static struct {
+        uint32_t start;    // Clock reading when the timer has been armed
+        uint16_t duration; // Time in ms until the timer expires
+} timer_banks[NUM_TIMER_BANKS][NUM_TIMERS];
 
+static uint8_t timer_bank_cur = 0;
+
+#if defined(__AVR_ATtiny25__) || defined(__AVR_ATtiny45__) || defined(__AVR_ATtiny85__)
+#define CLOCK_TIFR TIFR
 #else
+#define CLOCK_TIFR TIFR0
+#endif
+
+// The 1024 us overflow period is accumulated as 1 ms plus a 24 us fraction.
+// Fractions are stored in units of 8 us to fit into a byte.
+#define CLOCK_MS_INC (CLOCK_US_PER_OVF / 1000)
+#define CLOCK_FRACT_INC ((CLOCK_US_PER_OVF % 1000) >> 3)
+#define CLOCK_FRACT_MAX (1000 >> 3)
 
 // Interrupt controlled
-volatile static unsigned long timer_counter = 0; // Counts number of times TIMER0 has overflown
+// On Arduino builds, TIMER0 belongs to the Arduino core, so these
+// only hold the overflows credited by clock_release()
+volatile static uint32_t clock_ovf = 0;    // Number of TIMER0 overflows
+volatile static uint32_t clock_millis = 0; // Milliseconds since boot
+volatile static uint8_t clock_fract = 0;   // Millisecond fraction in units of 8 us
+
+static uint8_t hold_ticks;   // TCNT0 when the clock has been put on hold
+static bool hold_pending;    // Overflow pending when the clock has been put on hold
+
+/* clock_advance
+ * -------------
+ * Parameters:
+ *      n - Number of TIMER0 overflows
+ * Description:
+ *      Advances the clock by n overflow periods.
+ *      Must be called with interrupts disabled.
+ */
+static inline void clock_advance(uint16_t n)
+{
+        uint32_t m = clock_millis;
+        uint8_t f = clock_fract;
+
+        clock_ovf += n;
+
+        while (n--) {
+                m += CLOCK_MS_INC;
+                f += CLOCK_FRACT_INC;
+                if (f >= CLOCK_FRACT_MAX) {
+                        f -= CLOCK_FRACT_MAX;
+                        m++;
+                }
+        }
+
+        clock_millis = m;
+        clock_fract = f;
+}
+
+#ifndef ARDUINO_BUILD
 
 /* ISR(TIMER0_OVF_vect)
  * --------------------
  * Description:
- *      Increases the timer counter every time
- *      timer0 overflows.
+ *      Advances the clock every time timer0 overflows,
+ *      that is, roughly once every millisecond.
  */
 ISR(TIMER0_OVF_vect)
 {
-        timer_counter++;
+        clock_advance(1);
 }
 
 #endif
 
-/* reset_timer
- * -----------
+/* clock_ms
+ * --------
+ * Returns:
+ *      Milliseconds since boot
  * Description:
- *      Resets the the timer.
+ *      Returns an atomic snapshot of the free-running millisecond clock.
  */
-void reset_timer()
+uint32_t clock_ms()
 {
+        uint32_t ret;
+
+        ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+                ret = clock_millis;
+        }
+
 #ifdef ARDUINO_BUILD
-        start = millis();
-#else
-        TCNT0 = 0;
-        timer_counter = 0;
+        ret += millis();
 #endif
+
+        return ret;
 }
 
-/* ms_passed
- * --------------
+/* clock_us
+ * --------
+ * Returns:
+ *      Microseconds since boot, with a resolution of 4 us
  * Description:
- *      Returns the number of miliseconds that have passed 
- *      since the timer has been reset
+ *      Returns an atomic snapshot of the free-running microsecond
+ *      clock. The timer counter is read along with the overflow
+ *      count, so the resolution is a single timer tick.
+ *      Overflows every ~71 minutes.
  */
-unsigned long ms_passed()
+uint32_t clock_us()
 {
 #ifdef ARDUINO_BUILD
-        return millis() - start;
+        uint32_t ovf;
+
+        ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+                ovf = clock_ovf;
+        }
+
+        return micros() + ovf * CLOCK_US_PER_OVF;
 #else
-        return timer_counter / TMR_COUNTS_PER_MS;
+        uint32_t ovf;
+        uint8_t ticks;
+
+        ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+                ovf = clock_ovf;
+                ticks = TCNT0;
+
+                // Overflow occurred, but hasn't been serviced yet
+                if ((CLOCK_TIFR & (1 << TOV0)) && ticks < 255)
+                        ovf++;
+        }
+
+        return ((ovf << 8) + ticks) * CLOCK_US_PER_TICK;
 #endif
 }
+
+/* clock_hold
+ * ----------
+ * Description:
+ *      Notes the timer state at the start of a section that keeps
+ *      interrupts disabled for longer than a TIMER0 overflow period,
+ *      such as a WS2812 transmission. Must be called with interrupts
+ *      disabled, right after they have been turned off.
+ */
+void clock_hold()
+{
+        hold_ticks = TCNT0;
+        hold_pending = CLOCK_TIFR & (1 << TOV0);
+}
+
+/* clock_release
+ * -------------
+ * Parameters:
+ *      blocked_us - Time in us that has passed since clock_hold()
+ * Description:
+ *      Credits the overflows that have been lost while interrupts
+ *      were disabled back to the clock. TIMER0 can only flag a single
+ *      overflow, so all further overflows during that time are lost.
+ *      The provided duration must be accurate to ~0.5 ms, which is
+ *      sufficient to determine the exact number of overflows, as the
+ *      sub-overflow part is known from TCNT0. Must be called before
+ *      interrupts are enabled again.
+ */
+void clock_release(uint32_t blocked_us)
+{
+        uint8_t ticks = TCNT0;
+        bool pending = CLOCK_TIFR & (1 << TOV0);
+
+        // Total ticks since the last overflow before clock_hold() are
+        // ticks + 256 * n, where n is the number of overflows on hold
+        int32_t est = (int32_t) hold_ticks + blocked_us / CLOCK_US_PER_TICK;
+        int32_t n = (est - ticks + 128) >> 8;
+
+        if (n < 0)
+                n = 0;
+
+        if (pending && !hold_pending && n == 0)
+                n = 1;
+
+        // A pending overflow is still serviced once interrupts are enabled
+        n += hold_pending;
+        if (pending)
+                n--;
+
+        if (n > 0)
+                clock_advance(n);
+}
+
+/* frame_sync
+ * ----------
+ * Description:
+ *      Marks the start of a new frame. Must be called once at
+ *      the beginning of every main loop iteration.
+ *
+ *      If FRAME_RATE is set, the CPU idles until the next
+ *      frame is due. Frames that have been missed entirely,
+ *      because the previous frame took too long, are added to
+ *      frames_dropped and the schedule is resynchronized.
+ *
+ *      The time passed since the previous frame is stored in
+ *      frame_dt, which input_capture hands to the patches (see
+ *      input_frame), so animations advance by time rather than
+ *      by call count.
+ */
+void frame_sync()
+{
+        static uint32_t prev_ms;
+        static bool started = false;
+
+#if defined(FRAME_RATE) && FRAME_RATE > 0
+        static uint32_t deadline;
+        uint32_t now = clock_us();
+
+        if (!started) {
+                deadline = now;
+        }
+
+        int32_t late = now - deadline;
+
+        if (late < 0) {
+                while ((int32_t) (clock_us() - deadline) < 0)
+                        sleep_mode();
+                deadline += FRAME_TIME_US;
+        } else if ((uint32_t) late >= FRAME_TIME_US) {
+                frame_drops += late / FRAME_TIME_US;
+                deadline = now + FRAME_TIME_US;
+        } else {
+                deadline += FRAME_TIME_US;
+        }
+#endif
+
+        uint32_t ms = clock_ms();
+
+        if (!started) {
+                prev_ms = ms;
+                started = true;
+        }
+
+        uint32_t dt = ms - prev_ms;
+        frame_dt = (dt > FRAME_DT_MAX) ? FRAME_DT_MAX : dt;
+        prev_ms = ms;
+}
+
+/* frames_dropped
+ * --------------
+ * Returns:
+ *      Number of frames that could not be rendered in time since
+ *      startup (see frame_sync). Always 0 if FRAME_RATE is not set.
+ *      Wraps around after 65535 frames.
+ */
+uint16_t frames_dropped()
+{
+        return frame_drops;
+}
+
+/* timer_bank
+ * ----------
+ * Parameters:
+ *      bank - Index of the zone whose timers are used
+ * Description:
+ *      Selects the timer slots of a zone, so that the patches of
+ *      different zones don't share their timers. Bank 0 is also
+ *      used outside of zones.
+ */
+void timer_bank(uint8_t bank)
+{
+        timer_bank_cur = bank;
+}
+
+/* timer_reset
+ * -----------
+ * Parameters:
+ *      t - Timer slot
+ *      now - Current time in ms (see input_frame)
+ * Description:
+ *      Restarts the provided timer. The timer is
+ *      expired immediately.
+ */
+void timer_reset(uint8_t t, uint32_t now)
+{
+        timer_arm(t, 0, now);
+}
+
+/* timer_arm
+ * ---------
+ * Parameters:
+ *      t - Timer slot
+ *      ms - Time in ms after which the timer expires
+ *      now - Current time in ms (see input_frame)
+ * Description:
+ *      Restarts the provided timer and sets it to
+ *      expire after the given amount of ms.
+ */
+void timer_arm(uint8_t t, uint16_t ms, uint32_t now)
+{
+        timer_banks[timer_bank_cur][t].start = now;
+        timer_banks[timer_bank_cur][t].duration = ms;
+}
+
+/* timer_expired
+ * -------------
+ * Parameters:
+ *      t - Timer slot
+ *      now - Current time in ms (see input_frame)
+ * Description:
+ *      Returns true if the time the timer has been
+ *      armed with has passed.
+ */
+bool timer_expired(uint8_t t, uint32_t now)
+{
+        return timer_elapsed(t, now) >= timer_banks[timer_bank_cur][t].duration;
+}
+
+/* timer_elapsed
+ * -------------
+ * Parameters:
+ *      t - Timer slot
+ *      now - Current time in ms (see input_frame)
+ * Description:
+ *      Returns the number of milliseconds that have passed
+ *      since the timer has been reset or armed.
+ */
+uint32_t timer_elapsed(uint8_t t, uint32_t now)
+{
+        return now - timer_banks[timer_bank_cur][t].start;
+}
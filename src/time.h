@@ -29,7 +29,40 @@
 #define DELAY_MS(ms) _delay_ms(ms)
 #endif
 
-#define TMR_COUNTS_PER_MS 63 // F_CPU - 16Mhz | Prescaler - None
+#include <stdbool.h>
+#include <stdint.h>
 
-void reset_timer();
-unsigned long ms_passed();
\ No newline at end of file
+// TIMER0 runs with a prescaler of 64 (F_CPU - 16Mhz), which
+// results in a tick every 4 us and an overflow every 1024 us
+#define CLOCK_PRESCALER 64
+#define CLOCK_US_PER_TICK (CLOCK_PRESCALER / (F_CPU / 1000000L))
+#define CLOCK_US_PER_OVF (256 * CLOCK_US_PER_TICK)
+
+uint32_t clock_ms();
+uint32_t clock_us();
+void clock_hold();
+void clock_release(uint32_t blocked_us);
+
+// Longer frames (e.g. after calibration) are clamped
+// to this duration, so that animations do not jump
+#define FRAME_DT_MAX 250
+
+extern uint16_t frame_dt;
+
+void frame_sync();
+uint16_t frames_dropped();
+
+// Software timer slots
+// Each time based behaviour uses its own slot, so
+// that they do not interfere with one another
+enum timer_slot {
+        TMR_ANIM,       // Animation steps
+        TMR_ANIM_AUX,   // Secondary animation timing (pauses, spawn intervals)
+        NUM_TIMERS
+};
+
+void timer_reset(uint8_t t, uint32_t now);
+void timer_arm(uint8_t t, uint16_t ms, uint32_t now);
+bool timer_expired(uint8_t t, uint32_t now);
+uint32_t timer_elapsed(uint8_t t, uint32_t now);
+void timer_bank(uint8_t bank);
\ No newline at end of file
@@ -12,6 +12,7 @@
 #include <util/delay.h>
 
 #include "config.h"
+#include "time.h"
 #include "ws2812.h"
  
 #if STRIP_TYPE == WS2812
@@ -77,21 +78,115 @@
 #define w_nop8  w_nop4 w_nop4
 #define w_nop16 w_nop8 w_nop8
 
+// w1_nops as a string of nops
+#if (w1_nops&1)
+#define w1_nop1 w_nop1
+#else
+#define w1_nop1 ""
+#endif
+#if (w1_nops&2)
+#define w1_nop2 w_nop2
+#else
+#define w1_nop2 ""
+#endif
+#if (w1_nops&4)
+#define w1_nop4 w_nop4
+#else
+#define w1_nop4 ""
+#endif
+#if (w1_nops&8)
+#define w1_nop8 w_nop8
+#else
+#define w1_nop8 ""
+#endif
+#if (w1_nops&16)
+#define w1_nop16 w_nop16
+#else
+#define w1_nop16 ""
+#endif
+#define w1_nop_str w1_nop1 w1_nop2 w1_nop4 w1_nop8 w1_nop16
+
+// w2_nops as a string of nops
+#if (w2_nops&1)
+#define w2_nop1 w_nop1
+#else
+#define w2_nop1 ""
+#endif
+#if (w2_nops&2)
+#define w2_nop2 w_nop2
+#else
+#define w2_nop2 ""
+#endif
+#if (w2_nops&4)
+#define w2_nop4 w_nop4
+#else
+#define w2_nop4 ""
+#endif
+#if (w2_nops&8)
+#define w2_nop8 w_nop8
+#else
+#define w2_nop8 ""
+#endif
+#if (w2_nops&16)
+#define w2_nop16 w_nop16
+#else
+#define w2_nop16 ""
+#endif
+#define w2_nop_str w2_nop1 w2_nop2 w2_nop4 w2_nop8 w2_nop16
+
+// w3_nops as a string of nops
+#if (w3_nops&1)
+#define w3_nop1 w_nop1
+#else
+#define w3_nop1 ""
+#endif
+#if (w3_nops&2)
+#define w3_nop2 w_nop2
+#else
+#define w3_nop2 ""
+#endif
+#if (w3_nops&4)
+#define w3_nop4 w_nop4
+#else
+#define w3_nop4 ""
+#endif
+#if (w3_nops&8)
+#define w3_nop8 w_nop8
+#else
+#define w3_nop8 ""
+#endif
+#if (w3_nops&16)
+#define w3_nop16 w_nop16
+#else
+#define w3_nop16 ""
+#endif
+#define w3_nop_str w3_nop1 w3_nop2 w3_nop4 w3_nop8 w3_nop16
+
 static uint8_t _sreg_prev, _maskhi, _masklo;
 
+// Transmission time estimate, used to correct the clock once interrupts are restored
+#define WS2812_US_PER_PX ((24UL * w_totalperiod) / 1000) // 24 bits per pixel
+#define WS2812_US_PER_CALL 3                             // Typical gap between two kernel calls
+static uint16_t _tx_px, _tx_calls; // Pixels and kernel calls since ws2812_prep_tx()
+
 /* ws2812_prep_tx
  * --------------
  * Description:
  *      Prepares for a data transmission to the WS2812 strip.
- *      Always call this function before calling ws2812_tx_byte()!
+ *      Always call this function before calling ws2812_tx_run()
+ *      or ws2812_tx_buffer()!
  */
 void ws2812_prep_tx()
 {
         _masklo = ~WS2812_DIN_MSK & WS2812_DIN_PORT;
         _maskhi = WS2812_DIN_MSK | WS2812_DIN_PORT;
 
+        _tx_px = 0;
+        _tx_calls = 0;
+
         _sreg_prev=SREG;
         cli();  
+        clock_hold();
 }
 
 /* ws2812_wait_rst
@@ -108,100 +203,131 @@ void ws2812_wait_rst()
 
 /* ws2812_end_tx
  * -------------
+ * Parameters:
+ *      stall_us - Time in us spent between kernel calls beyond
+ *                 WS2812_US_PER_CALL, e.g. by pixel generators
  * Description:
  *      Ends data transmission with the WS2812 by 
  *      restoring the status register to its previous state
  *      and re-enabling interrupts. Always call this function
  *      after data transmission is complete!
+ *
+ *      Timer0 overflows are lost while interrupts are disabled,
+ *      hence the clock is corrected by the estimated transmission
+ *      time (see clock_release) before interrupts are restored.
  */
-void ws2812_end_tx()
+void ws2812_end_tx(uint32_t stall_us)
 {
+        clock_release(_tx_px * WS2812_US_PER_PX + (uint32_t) _tx_calls * WS2812_US_PER_CALL + stall_us);
         SREG=_sreg_prev;
         ws2812_wait_rst();
         sei();
 }
 
-/* ws2812_tx_byte
+/* WS2812_TX_BITS
  * --------------
  * Description:
- *      Transmitts a byte of data to the WS2812.
- *      Toggling this function three times consecutively, sets a pixel.
- *      After every third consecutive transmission, the next pixel is
- *      written to. Transmissions MUST take place consecutively, else
- *      there's a risk that the timing fails and the strip will either
- *      be written to incorrectly, or not be written to at all.
+ *      Inline assembly that shifts out the 8 bits held in the
+ *      %[byte] operand, MSB first. Expects the %[ctr] (upper register),
+ *      %[hi] and %[lo] operands, as well as X pointing to the DIN port.
+ *      Uses the local labels 1 and 2, so the kernels below
+ *      must only use label 0 for their own loops.
  */
+#define WS2812_TX_BITS \
+                "       ldi   %[ctr],8      \n\t" \
+                "1:                         \n\t" \
+                "       st    X,%[hi]       \n\t"    /*  '1' [02] '0' [02] - re      */ \
+                w1_nop_str \
+                "       sbrs  %[byte],7     \n\t"    /*  '1' [04] '0' [03]           */ \
+                "       st    X,%[lo]       \n\t"    /*  '1' [--] '0' [05] - fe-low  */ \
+                "       lsl   %[byte]       \n\t"    /*  '1' [05] '0' [06]           */ \
+                w2_nop_str \
+                "       brcc  2f            \n\t"    /*  '1' [+1] '0' [+2]           */ \
+                "       st    X,%[lo]       \n\t"    /*  '1' [+3] '0' [--] - fe-high */ \
+                "2:                         \n\t"    /*  '1' [+3] '0' [+2]           */ \
+                w3_nop_str \
+                "       dec   %[ctr]        \n\t"    /*  '1' [+4] '0' [+3]           */ \
+                "       brne  1b            \n\t"    /*  '1' [+5] '0' [+4]           */
 
-#pragma GCC push_options
-#pragma GCC optimize ("O0")
-
-void ws2812_tx_byte(uint8_t data)
+/* ws2812_tx_run
+ * -------------
+ * Parameters:
+ *      rgb - RGB value (R, G, B order) of the pixel run
+ *      n - Number of pixels in the run
+ * Description:
+ *      Transmits the same pixel n times in a single hand-timed
+ *      loop. The color order is applied once, before the loop
+ *      is entered, so consecutive bytes are only separated by
+ *      a few cycles of the low phase.
+ *      Must be called between ws2812_prep_tx() and ws2812_end_tx().
+ */
+void ws2812_tx_run(const uint8_t *rgb, uint16_t n)
 {
-        uint8_t ctr;
+        uint8_t ctr, byte;
+
+        if (n == 0)
+                return;
+
+        _tx_px += n;
+        _tx_calls++;
 
         asm volatile(
-                "       ldi   %0,8  \n\t"
-                "loop%=:            \n\t"
-                "       st    X,%3 \n\t"    //  '1' [02] '0' [02] - re
-                #if (w1_nops&1)
-                w_nop1
-                #endif
-                #if (w1_nops&2)
-                w_nop2
-                #endif
-                #if (w1_nops&4)
-                w_nop4
-                #endif
-                #if (w1_nops&8)
-                w_nop8
-                #endif
-                #if (w1_nops&16)
-                w_nop16
-                #endif
-                "       sbrs  %1,7  \n\t"    //  '1' [04] '0' [03]
-                "       st    X,%4 \n\t"     //  '1' [--] '0' [05] - fe-low
-                "       lsl   %1    \n\t"    //  '1' [05] '0' [06]
-                #if (w2_nops&1)
-                w_nop1
-                #endif
-                #if (w2_nops&2)
-                w_nop2
-                #endif
-                #if (w2_nops&4)
-                w_nop4
-                #endif
-                #if (w2_nops&8)
-                w_nop8
-                #endif
-                #if (w2_nops&16)
-                w_nop16 
-                #endif
-                "       brcc skipone%= \n\t"    //  '1' [+1] '0' [+2] - 
-                "       st   X,%4      \n\t"    //  '1' [+3] '0' [--] - fe-high
-                "skipone%=:               "     //  '1' [+3] '0' [+2] - 
-
-                #if (w3_nops&1)
-                w_nop1
-                #endif
-                #if (w3_nops&2)
-                w_nop2
-                #endif
-                #if (w3_nops&4)
-                w_nop4
-                #endif
-                #if (w3_nops&8)
-                w_nop8
-                #endif
-                #if (w3_nops&16)
-                w_nop16
-                #endif
-                "       dec   %0    \n\t"    //  '1' [+4] '0' [+3]
-                "       brne  loop%=\n\t"    //  '1' [+5] '0' [+4]
-                :	"=&d" (ctr)
-                :	"r" (data), "x" ((uint8_t *) &WS2812_DIN_PORT), "r" (_maskhi), "r" (_masklo)
+                "0:                         \n\t"
+                "       mov   %[byte],%[b0] \n\t"
+                WS2812_TX_BITS
+                "       mov   %[byte],%[b1] \n\t"
+                WS2812_TX_BITS
+                "       mov   %[byte],%[b2] \n\t"
+                WS2812_TX_BITS
+                "       sbiw  %[n],1        \n\t"
+                "       brne  0b            \n\t"
+                :       [ctr] "=&d" (ctr), [byte] "=&r" (byte), [n] "+w" (n)
+                :       [b0] "r" (rgb[WS2812_WIRING_RGB_0]),
+                        [b1] "r" (rgb[WS2812_WIRING_RGB_1]),
+                        [b2] "r" (rgb[WS2812_WIRING_RGB_2]),
+                        "x" ((uint8_t *) &WS2812_DIN_PORT), [hi] "r" (_maskhi), [lo] "r" (_masklo)
         );
 }
 
-#pragma GCC pop_options
+/* ws2812_tx_buffer
+ * ----------------
+ * Parameters:
+ *      buf - Contiguous buffer of RGB values (R, G, B order, 3 bytes per pixel)
+ *      n - Number of pixels in the buffer
+ * Description:
+ *      Streams a whole pixel buffer to the strip in a single
+ *      hand-timed loop. Bytes are loaded in wiring order straight
+ *      from the buffer, so no copies or per-byte calls are required.
+ *      Must be called between ws2812_prep_tx() and ws2812_end_tx().
+ */
+void ws2812_tx_buffer(const uint8_t *buf, uint16_t n)
+{
+        uint8_t ctr, byte;
+
+        if (n == 0)
+                return;
+
+        _tx_px += n;
+        _tx_calls++;
+
+        asm volatile(
+                "0:                         \n\t"
+                "       ldd   %[byte],Z+%[o0] \n\t"
+                WS2812_TX_BITS
+                "       ldd   %[byte],Z+%[o1] \n\t"
+                WS2812_TX_BITS
+                "       ldd   %[byte],Z+%[o2] \n\t"
+                WS2812_TX_BITS
+                "       adiw  %[buf],3      \n\t"
+                "       sbiw  %[n],1        \n\t"
+                "       brne  0b            \n\t"
+                :       [ctr] "=&d" (ctr), [byte] "=&r" (byte), [n] "+w" (n), [buf] "+z" (buf)
+                :       [o0] "I" (WS2812_WIRING_RGB_0),
+                        [o1] "I" (WS2812_WIRING_RGB_1),
+                        [o2] "I" (WS2812_WIRING_RGB_2),
+                        "x" ((uint8_t *) &WS2812_DIN_PORT), [hi] "r" (_maskhi), [lo] "r" (_masklo)
+                :       "memory"
+        );
+}
 
 #endif
\ No newline at end of file
@@ -22,9 +22,17 @@
 #define WS2812_DIN_MSK (1 << WS2812_DIN)
 #endif
 
+// Longest low phase between two pixels that is safely
+// not mistaken for a reset (latch) by WS2812(B) strips.
+// Everything between two kernel calls must fit into it,
+// see pxgen_t in strip.h for what that leaves per pixel.
+#define WS2812_MAX_GAP_US 5
+#define WS2812_MAX_GAP_CYCLES ((F_CPU / 1000000) * WS2812_MAX_GAP_US)
+
 void ws2812_prep_tx();
 void ws2812_wait_rst();
-void ws2812_tx_byte(uint8_t byte);
-void ws2812_end_tx();
+void ws2812_tx_run(const uint8_t *rgb, uint16_t n);
+void ws2812_tx_buffer(const uint8_t *buf, uint16_t n);
+void ws2812_end_tx(uint32_t stall_us);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,8 @@
+#pragma once
+
+#include <stdint.h>
+
+#define EEMEM
+
+static inline void eeprom_update_word(uint16_t *p, uint16_t v) { *p = v; }
+static inline uint16_t eeprom_read_word(const uint16_t *p) { return *p; }
@@ -0,0 +1,5 @@
+#pragma once
+
+#define ISR(vect) void vect()
+#define cli()
+#define sei()
@@ -0,0 +1,9 @@
+#pragma once
+
+#include <stdint.h>
+
+#define PB0 0
+#define PB1 1
+#define PB2 2
+#define PB3 3
+#define PB4 4
@@ -0,0 +1,51 @@
+/*
+ * Host stand-ins for the modules strip.cpp depends on (ws2812.cpp,
+ * time.cpp and input.cpp), for tests that include strip.cpp. The
+ * WS2812 driver records the pixels of the last transmitted frame in
+ * host_px, as 0xRRGGBB in the order they were sent.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+
+#include "ws2812.h"
+#include "time.h"
+#include "input.h"
+
+static std::vector<uint32_t> host_px;
+
+void ws2812_prep_tx()
+{
+        host_px.clear();
+}
+
+void ws2812_wait_rst() {}
+void ws2812_end_tx(uint32_t stall_us) {}
+
+void ws2812_tx_run(const uint8_t *rgb, uint16_t n)
+{
+        while (n--)
+                host_px.push_back((uint32_t) rgb[0] << 16 | (uint32_t) rgb[1] << 8 | rgb[2]);
+}
+
+void ws2812_tx_buffer(const uint8_t *buf, uint16_t n)
+{
+        for (uint16_t i = 0; i < n; i++, buf += 3)
+                ws2812_tx_run(buf, 1);
+}
+
+uint16_t frame_dt = 0;
+
+uint32_t clock_ms() { return 0; }
+uint32_t clock_us() { return 0; }
+void timer_reset(uint8_t t, uint32_t now) {}
+void timer_arm(uint8_t t, uint16_t ms, uint32_t now) {}
+bool timer_expired(uint8_t t, uint32_t now) { return true; }
+uint32_t timer_elapsed(uint8_t t, uint32_t now) { return 0; }
+void timer_bank(uint8_t bank) {}
+
+uint8_t btn_event() { return BTN_NONE; }
+void btn_flush() {}
+uint8_t pot_smooth() { return 0; }
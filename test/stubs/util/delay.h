@@ -0,0 +1,4 @@
+#pragma once
+
+static inline void _delay_ms(double ms) { (void) ms; }
+static inline void _delay_us(double us) { (void) us; }
@@ -0,0 +1,203 @@
+/*
+ * Host tests of the integer color math (see color.h), run with
+ * `pio test -e native`. The results must be bit-identical to the
+ * double precision math that the integer math replaced.
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <unity.h>
+
+// Covers the 16-bit CIE table (see cie16)
+#define PERCEPTUAL_BRIGHTNESS
+
+#include "color.cpp"
+
+void setUp() {}
+void tearDown() {}
+
+/* test_scale8
+ * -----------
+ * Description:
+ *      Compares scale8 to the former rgb_apply_brightness
+ *      expression for all 65,536 (value, scale) pairs.
+ */
+void test_scale8()
+{
+        for (uint16_t val = 0; val < 256; val++) {
+                for (uint16_t scale = 0; scale < 256; scale++) {
+                        uint8_t ref = round(((double) scale / 255) * (double) val);
+
+                        if (scale8(val, scale) != ref) {
+                                char msg[32];
+                                snprintf(msg, sizeof(msg), "val %u, scale %u", val, scale);
+                                TEST_FAIL_MESSAGE(msg);
+                        }
+                }
+        }
+}
+
+/* test_scale8_buf
+ * ---------------
+ * Description:
+ *      Checks that buffers are scaled byte by byte.
+ */
+void test_scale8_buf()
+{
+        for (uint16_t scale = 0; scale < 256; scale++) {
+                uint8_t buf[256];
+
+                for (uint16_t i = 0; i < 256; i++)
+                        buf[i] = i;
+
+                scale8_buf(buf, sizeof(buf), scale);
+
+                for (uint16_t i = 0; i < 256; i++)
+                        TEST_ASSERT_EQUAL_UINT8(scale8(i, scale), buf[i]);
+        }
+}
+
+/* check_scale8_dither
+ * -------------------
+ * Parameters:
+ *      scale - 16-bit scale factor
+ * Description:
+ *      Checks scale8_dither for every value at the provided scale.
+ *      Every offset must round val * scale / 65535 up or down, and
+ *      the mean over all offsets must lie within 1/256 of it.
+ */
+static void check_scale8_dither(uint16_t scale)
+{
+        for (uint16_t val = 0; val < 256; val++) {
+                double ref = (double) val * scale / 65535;
+                uint32_t sum = 0;
+
+                for (uint16_t dither = 0; dither < 256; dither++) {
+                        uint8_t x = scale8_dither(val, scale, dither);
+
+                        if (x < floor(ref) || x > ceil(ref)) {
+                                char msg[48];
+                                snprintf(msg, sizeof(msg), "val %u, scale %u, dither %u", val, scale, dither);
+                                TEST_FAIL_MESSAGE(msg);
+                        }
+
+                        sum += x;
+                }
+
+                if (fabs(sum - ref * 256) >= 1) {
+                        char msg[48];
+                        snprintf(msg, sizeof(msg), "mean of val %u, scale %u", val, scale);
+                        TEST_FAIL_MESSAGE(msg);
+                }
+        }
+}
+
+/* test_scale8_dither
+ * ------------------
+ * Description:
+ *      Checks scale8_dither at every 8-bit brightness (v * 257),
+ *      every CIE brightness and a spread of other 16-bit scales.
+ *      Off and full brightness must be exact for every offset.
+ */
+void test_scale8_dither()
+{
+        for (uint16_t b = 0; b < 256; b++) {
+                check_scale8_dither(b * 257);
+                check_scale8_dither(cie16(b));
+        }
+
+        for (uint32_t scale = 1; scale < 65535; scale += 97)
+                check_scale8_dither(scale);
+
+        for (uint16_t val = 0; val < 256; val++) {
+                for (uint16_t dither = 0; dither < 256; dither++) {
+                        TEST_ASSERT_EQUAL_UINT8(0, scale8_dither(val, 0, dither));
+                        TEST_ASSERT_EQUAL_UINT8(val, scale8_dither(val, 65535, dither));
+                }
+        }
+}
+
+/* test_round8
+ * -----------
+ * Description:
+ *      Compares round8 to round(val / 257) for every 16-bit value.
+ */
+void test_round8()
+{
+        for (uint32_t val = 0; val < 65536; val++) {
+                if (round8(val) != (uint8_t) round(val / 257.0)) {
+                        char msg[32];
+                        snprintf(msg, sizeof(msg), "val %u", (unsigned) val);
+                        TEST_FAIL_MESSAGE(msg);
+                }
+        }
+}
+
+/* test_cie8
+ * ---------
+ * Description:
+ *      Compares cie8, which is rounded from the 16-bit table, to
+ *      the former 8-bit table, round(255 * Y).
+ */
+void test_cie8()
+{
+        for (uint16_t val = 0; val < 256; val++) {
+                double l = val * 100 / 255.0;
+                double y = (l <= 8) ? l / 903.3 : pow((l + 16) / 116, 3);
+
+                TEST_ASSERT_EQUAL_UINT8((uint8_t) (255 * y + 0.5), cie8(val));
+        }
+}
+
+/* test_avg8
+ * ---------
+ * Description:
+ *      Compares avg8 to the former adc_avg expression for every
+ *      sample count and every sum of 8-bit samples.
+ */
+void test_avg8()
+{
+        for (uint16_t samples = 1; samples < 256; samples++) {
+                for (uint32_t sum = 0; sum <= 255 * samples; sum++) {
+                        uint8_t ref = round((double) sum / samples);
+
+                        if (avg8(sum, samples) != ref) {
+                                char msg[32];
+                                snprintf(msg, sizeof(msg), "sum %u, samples %u", (unsigned) sum, samples);
+                                TEST_FAIL_MESSAGE(msg);
+                        }
+                }
+        }
+}
+
+/* test_hue_mul
+ * ------------
+ * Description:
+ *      Compares hue_mul to the 32-bit modulo it replaced for
+ *      every step count and step size.
+ */
+void test_hue_mul()
+{
+        for (uint32_t n = 0; n < 65536; n++) {
+                for (uint16_t step = 0; step < 256; step++) {
+                        if (hue_mul(n, step) != n * step % HUE_MAX) {
+                                char msg[32];
+                                snprintf(msg, sizeof(msg), "n %u, step %u", (unsigned) n, step);
+                                TEST_FAIL_MESSAGE(msg);
+                        }
+                }
+        }
+}
+
+int main()
+{
+        UNITY_BEGIN();
+        RUN_TEST(test_scale8);
+        RUN_TEST(test_scale8_buf);
+        RUN_TEST(test_scale8_dither);
+        RUN_TEST(test_round8);
+        RUN_TEST(test_cie8);
+        RUN_TEST(test_avg8);
+        RUN_TEST(test_hue_mul);
+        return UNITY_END();
+}
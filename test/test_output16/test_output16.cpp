@@ -0,0 +1,139 @@
+/*
+ * Host tests of the 16-bit output stage (see output16 in strip.cpp),
+ * run with `pio test -e native`. Colors assigned trough COLOR8 must
+ * be sent exactly like their 8-bit values, at every brightness and
+ * every dither offset.
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <unity.h>
+
+#define COLOR_16BIT
+#define TEMPORAL_DITHERING
+
+#include "color.cpp"
+#include "strip.cpp"
+#include "strip_host.h"
+
+void setUp() {}
+void tearDown() {}
+
+/* test_output_px
+ * --------------
+ * Description:
+ *      Compares the 16-bit output stage to the 8-bit one for every
+ *      8-bit value, brightness and dither offset.
+ */
+void test_output_px()
+{
+        for (uint16_t b = 0; b < 256; b++) {
+                strip_set_brightness(b);
+
+                for (uint16_t d = 0; d < 256; d++) {
+                        out_dither = d;
+
+                        for (uint16_t v = 0; v < 256; v++) {
+                                uint8_t src8[3] = {(uint8_t) v, (uint8_t) (255 - v), (uint8_t) (v ^ 0x5A)};
+                                uint16_t src16[3] = {COLOR8(src8[R]), COLOR8(src8[G]), COLOR8(src8[B])};
+                                RGB_t px8, px16;
+
+                                output_px(px8, src8);
+                                output_px(px16, src16);
+
+                                if (memcmp(px8, px16, sizeof(RGB_t))) {
+                                        char msg[48];
+                                        snprintf(msg, sizeof(msg), "val %u, brightness %u, dither %u", v, b, d);
+                                        TEST_FAIL_MESSAGE(msg);
+                                }
+                        }
+                }
+        }
+}
+
+/* test_output16_range
+ * -------------------
+ * Description:
+ *      Checks that 16-bit channels between the 8-bit values are
+ *      rounded up or down from val * brightness * 255 / 65535^2
+ *      at every dither offset, and that off and full brightness
+ *      are exact.
+ */
+void test_output16_range()
+{
+        for (uint32_t scale = 0; scale < 65536; scale += 61) {
+                out_brightness = scale;
+
+                for (uint32_t val = 0; val < 65536; val += 37) {
+                        double ref = (double) val * scale * 255 / 65535 / 65535;
+
+                        for (uint16_t d = 0; d < 256; d += 15) {
+                                out_dither = d;
+                                uint8_t x = output16(val);
+
+                                // Channels with unequal bytes are scaled up to 1/256 off
+                                if (x < floor(ref - 1.0 / 256) || x > ceil(ref + 1.0 / 256)) {
+                                        char msg[48];
+                                        snprintf(msg, sizeof(msg), "val %u, scale %u, dither %u",
+                                                 (unsigned) val, (unsigned) scale, d);
+                                        TEST_FAIL_MESSAGE(msg);
+                                }
+                        }
+                }
+        }
+
+        for (uint16_t d = 0; d < 256; d++) {
+                out_dither = d;
+
+                out_brightness = 0;
+                TEST_ASSERT_EQUAL_UINT8(0, output16(65535));
+
+                out_brightness = 65535;
+                TEST_ASSERT_EQUAL_UINT8(0, output16(0));
+                TEST_ASSERT_EQUAL_UINT8(255, output16(65535));
+        }
+}
+
+/* test_substrpbuf
+ * ---------------
+ * Description:
+ *      Sends a substrip buffer trough the whole frame pipeline and
+ *      compares the pixels to the 8-bit output stage.
+ */
+void test_substrpbuf()
+{
+        static const uint8_t colors[3][3] = {{255, 0, 0}, {17, 128, 200}, {1, 2, 3}};
+        substrp substrps[3];
+        substrpbuf buf = {3, substrps};
+
+        strip_size = 30;
+
+        for (uint8_t i = 0; i < 3; i++) {
+                substrps[i].length = 10;
+                for (uint8_t c = 0; c < 3; c++)
+                        substrps[i].rgb[c] = COLOR8(colors[i][c]);
+        }
+
+        for (uint16_t b = 0; b < 256; b += 3) {
+                strip_set_brightness(b);
+                strip_apply_substrpbuf(buf);
+
+                TEST_ASSERT_EQUAL(30, host_px.size());
+
+                for (uint16_t i = 0; i < 30; i++) {
+                        RGB_t px;
+
+                        output_px(px, colors[i / 10]);
+                        TEST_ASSERT_EQUAL((uint32_t) px[R] << 16 | (uint32_t) px[G] << 8 | px[B], host_px[i]);
+                }
+        }
+}
+
+int main()
+{
+        UNITY_BEGIN();
+        RUN_TEST(test_output_px);
+        RUN_TEST(test_output16_range);
+        RUN_TEST(test_substrpbuf);
+        return UNITY_END();
+}
@@ -0,0 +1,109 @@
+/*
+ * Host tests of palettised buffers (see palbuf in strip.h), run with
+ * `pio test -e native`. The palette is only expanded in the frame
+ * arena while the buffer is sent, 2-bit buffers must only cycle and
+ * send their 4 colors.
+ */
+
+#include <stdio.h>
+#include <unity.h>
+
+#define PALBUF_PIXELS 40
+
+#include "color.cpp"
+#include "strip.cpp"
+#include "strip_host.h"
+
+void setUp() {}
+void tearDown() {}
+
+static uint32_t out_rgb(const color_t *color)
+{
+        RGB_t rgb, px;
+
+        color_get(rgb, color);
+        output_px(px, rgb);
+        return (uint32_t) px[R] << 16 | (uint32_t) px[G] << 8 | px[B];
+}
+
+/* test_cycle_2bit
+ * ---------------
+ * Description:
+ *      Cycles a 2-bit buffer over the whole PALETTE_SIZE and checks
+ *      that only its 4 colors are rotated.
+ */
+void test_cycle_2bit()
+{
+        static uint8_t idx[PALBUF_BYTES(PALBUF_PIXELS, 2)];
+        palbuf buf;
+
+        palbuf_init(&buf, idx, PALBUF_PIXELS, 2);
+        TEST_ASSERT_EQUAL(2, buf.bits);
+
+        for (uint8_t i = 0; i < PALETTE_SIZE; i++) {
+                RGB_t rgb = {i, i, i};
+
+                color_set(buf.palette[i], rgb);
+        }
+
+        palbuf_cycle(&buf, 0, PALETTE_SIZE);
+
+        TEST_ASSERT_EQUAL(COLOR8(3), buf.palette[0][R]);
+        for (uint8_t i = 1; i < 4; i++)
+                TEST_ASSERT_EQUAL(COLOR8(i - 1), buf.palette[i][R]);
+        for (uint8_t i = 4; i < PALETTE_SIZE; i++)
+                TEST_ASSERT_EQUAL(COLOR8(i), buf.palette[i][R]);
+}
+
+/* test_apply_palbuf
+ * -----------------
+ * Description:
+ *      Sends 2-bit and PALBUF_BITS buffers at different brightnesses
+ *      and compares every pixel to the output stage of its palette
+ *      color. The arena must be free again after every frame.
+ */
+void test_apply_palbuf()
+{
+        static uint8_t idx[PALBUF_BYTES(PALBUF_PIXELS, PALBUF_BITS)];
+        static const uint8_t bits[] = {2, PALBUF_BITS};
+        palbuf buf;
+
+        strip_size = 50;
+
+        for (uint8_t b = 0; b < sizeof(bits); b++) {
+                palbuf_init(&buf, idx, PALBUF_PIXELS, bits[b]);
+
+                for (uint8_t i = 0; i < (1 << buf.bits); i++) {
+                        RGB_t rgb = {(uint8_t) (i * 16), 255, (uint8_t) (255 - i)};
+
+                        color_set(buf.palette[i], rgb);
+                }
+
+                for (uint16_t i = 0; i < PALBUF_PIXELS; i++)
+                        palbuf_set(&buf, i, i * 7);
+
+                for (uint16_t br = 255; br > 0; br -= 85) {
+                        strip_set_brightness(br);
+                        palbuf_cycle(&buf, 0, PALETTE_SIZE);
+
+                        strip_frame_begin();
+                        strip_apply_palbuf(&buf);
+                        strip_frame_end();
+
+                        TEST_ASSERT_EQUAL(50, host_px.size());
+                        for (uint16_t i = 0; i < PALBUF_PIXELS; i++)
+                                TEST_ASSERT_EQUAL(out_rgb(buf.palette[palbuf_get(&buf, i)]), host_px[i]);
+                        for (uint16_t i = PALBUF_PIXELS; i < 50; i++)
+                                TEST_ASSERT_EQUAL(0, host_px[i]);
+                        TEST_ASSERT_EQUAL(0, arena_top);
+                }
+        }
+}
+
+int main()
+{
+        UNITY_BEGIN();
+        RUN_TEST(test_cycle_2bit);
+        RUN_TEST(test_apply_palbuf);
+        return UNITY_END();
+}
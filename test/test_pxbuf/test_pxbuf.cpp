@@ -0,0 +1,153 @@
+/*
+ * Host tests of the pixel buffer pool (see pxbuf in strip.h), run
+ * with `pio test -e native`. Random operations are applied to a
+ * pixel buffer and to a std::map, and both must agree after every
+ * operation.
+ */
+
+#include <map>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unity.h>
+
+#include "color.cpp"
+#include "strip.cpp"
+#include "strip_host.h"
+
+#define FUZZ_STRIP_SIZE 200
+#define FUZZ_OPS 200000
+
+typedef std::map<uint16_t, uint32_t> pxmap;
+
+void setUp() {}
+void tearDown() {}
+
+static uint32_t px_rgb(const pxl *px)
+{
+        RGB_t rgb;
+
+        color_get(rgb, px->rgb);
+        return (uint32_t) rgb[R] << 16 | (uint32_t) rgb[G] << 8 | rgb[B];
+}
+
+/* check_pxbuf
+ * -----------
+ * Parameters:
+ *      buf - Pointer to a pixel buffer
+ *      ref - Expected pixels (position to 0xRRGGBB)
+ *      op - Index of the last operation, for failure messages
+ * Description:
+ *      Checks the invariants of the pool (sorted slots, pixel count,
+ *      no trailing removed slots) and compares its pixels to ref.
+ */
+static void check_pxbuf(const pxbuf *buf, const pxmap &ref, uint32_t op)
+{
+        char msg[48];
+        uint16_t n = 0;
+        pxmap::const_iterator it = ref.begin();
+
+        snprintf(msg, sizeof(msg), "operation %u", (unsigned) op);
+
+        TEST_ASSERT_TRUE_MESSAGE(buf->size <= PXBUF_SIZE, msg);
+        TEST_ASSERT_TRUE_MESSAGE(buf->size == 0 || pxbuf_used(buf, buf->size - 1), msg);
+
+        for (uint16_t i = 0; i < buf->size; i++) {
+                if (i > 0)
+                        TEST_ASSERT_TRUE_MESSAGE(buf->buf[i - 1].pos < buf->buf[i].pos, msg);
+
+                if (!pxbuf_used(buf, i))
+                        continue;
+
+                TEST_ASSERT_TRUE_MESSAGE(it != ref.end(), msg);
+                TEST_ASSERT_EQUAL_MESSAGE(it->first, buf->buf[i].pos, msg);
+                TEST_ASSERT_EQUAL_MESSAGE(it->second, px_rgb(&buf->buf[i]), msg);
+                ++it;
+                n++;
+        }
+
+        TEST_ASSERT_TRUE_MESSAGE(it == ref.end(), msg);
+        TEST_ASSERT_EQUAL_MESSAGE(ref.size(), buf->n, msg);
+        TEST_ASSERT_EQUAL_MESSAGE(ref.size(), n, msg);
+}
+
+/* check_frame
+ * -----------
+ * Parameters:
+ *      buf - Pointer to a pixel buffer
+ *      ref - Expected pixels (position to 0xRRGGBB)
+ *      op - Index of the last operation, for failure messages
+ * Description:
+ *      Sends the pixel buffer and compares the frame to ref,
+ *      with all other pixels off.
+ */
+static void check_frame(pxbuf *buf, const pxmap &ref, uint32_t op)
+{
+        char msg[48];
+
+        snprintf(msg, sizeof(msg), "frame of operation %u", (unsigned) op);
+
+        strip_apply_pxbuf(buf);
+        TEST_ASSERT_EQUAL_MESSAGE(FUZZ_STRIP_SIZE, host_px.size(), msg);
+
+        for (uint16_t i = 0; i < FUZZ_STRIP_SIZE; i++) {
+                pxmap::const_iterator it = ref.find(i);
+                TEST_ASSERT_EQUAL_MESSAGE((it == ref.end()) ? 0 : it->second, host_px[i], msg);
+        }
+}
+
+/* test_pxbuf_fuzz
+ * ---------------
+ * Description:
+ *      Applies random insertions, updates and removals (by position
+ *      and by slot) to a pixel buffer, biased so that the pool runs
+ *      full as well as empty, and compares it to a std::map.
+ */
+void test_pxbuf_fuzz()
+{
+        static pxbuf buf;
+        pxmap ref;
+
+        srand(1);
+        pxbuf_init(&buf);
+        strip_size = FUZZ_STRIP_SIZE;
+
+        for (uint32_t op = 0; op < FUZZ_OPS; op++) {
+                // Phases of mostly insertions and mostly removals
+                bool fill = (op / 5000) & 1;
+                uint16_t pos = rand() % FUZZ_STRIP_SIZE;
+                uint8_t r = rand() % 10;
+
+                if (r < (fill ? 7 : 3)) {
+                        RGB_t rgb = {(uint8_t) (1 + rand() % 255), (uint8_t) rand(), (uint8_t) rand()};
+                        bool full = ref.size() == PXBUF_SIZE && !ref.count(pos);
+
+                        TEST_ASSERT_EQUAL(!full, pxbuf_insert(&buf, pos, rgb));
+                        if (!full)
+                                ref[pos] = (uint32_t) rgb[R] << 16 | (uint32_t) rgb[G] << 8 | rgb[B];
+                } else if (r < 8) {
+                        TEST_ASSERT_EQUAL(ref.erase(pos) == 1, pxbuf_remove_at(&buf, pos));
+                } else if (r < 9) {
+                        if (buf.size) {
+                                uint16_t i = rand() % buf.size;
+
+                                if (pxbuf_used(&buf, i))
+                                        ref.erase(buf.buf[i].pos);
+                                pxbuf_remove(&buf, i);
+                        }
+                } else {
+                        TEST_ASSERT_EQUAL(ref.count(pos) == 1, pxbuf_exists(&buf, pos));
+                }
+
+                check_pxbuf(&buf, ref, op);
+
+                if (op % 97 == 0)
+                        check_frame(&buf, ref, op);
+        }
+}
+
+int main()
+{
+        UNITY_BEGIN();
+        RUN_TEST(test_pxbuf_fuzz);
+        return UNITY_END();
+}
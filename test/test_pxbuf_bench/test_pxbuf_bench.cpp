@@ -0,0 +1,333 @@
+/*
+ * Host benchmark of the pixel buffer pool (see pxbuf in strip.h)
+ * against the heap-backed pixel buffer it replaced, run with
+ * `pio test -e native -f test_pxbuf_bench -v` to see the table.
+ * Both buffers are filled with the same drops, up to the strip
+ * size, and must send the same frames. The pool only holds
+ * PXBUF_SIZE drops, raise it in the config file to bench more.
+ *
+ * The timings are of the host CPU and its malloc, not of an AVR and
+ * avr-libc, so only compare the two columns of a row, not the rows
+ * to the cycle budget of the firmware.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/time.h>
+#include <unity.h>
+
+#include "color.cpp"
+#include "strip.cpp"
+#include "strip_host.h"
+
+#define BENCH_STRIP_SIZE 600
+#define BENCH_ROUNDS 128        // Buffers filled per row, timed together
+
+void setUp() {}
+void tearDown() {}
+
+/* heap_pxbuf
+ * ----------
+ * Description:
+ *      The pixel buffer before the pool, a sorted array that is
+ *      reallocated on every insertion and removal.
+ */
+typedef struct heap_pxbuf {
+        uint16_t size;
+        pxl *buf;
+} heap_pxbuf;
+
+static void heap_insert(heap_pxbuf *buf, uint16_t pos, RGB_t rgb)
+{
+        if (buf->size == 0) {
+                buf->buf = (pxl *)malloc(sizeof(pxl));
+                buf->buf[0].pos = pos;
+                color_set(buf->buf[0].rgb, rgb);
+                buf->size++;
+                return;
+        }
+
+        for (uint16_t i = 0; i < buf->size; i++) {
+                if (buf->buf[i].pos == pos) {
+                        color_set(buf->buf[i].rgb, rgb);
+                        return;
+                }
+
+                if (buf->buf[i].pos > pos) {
+                        buf->size++;
+                        buf->buf = (pxl *)realloc(buf->buf, sizeof(pxl) * buf->size);
+
+                        for (uint16_t j = buf->size-1; j > i; j--) {
+                                pxl* prev_px = &(buf->buf[j-1]);
+                                buf->buf[j].pos = prev_px->pos;
+                                color_cpy(buf->buf[j].rgb, prev_px->rgb);
+                        }
+
+                        buf->buf[i].pos = pos;
+                        color_set(buf->buf[i].rgb, rgb);
+
+                        return;
+                }
+        }
+
+        buf->size++;
+        buf->buf = (pxl *)realloc(buf->buf, sizeof(pxl) * buf->size);
+        buf->buf[buf->size-1].pos = pos;
+        color_set(buf->buf[buf->size-1].rgb, rgb);
+}
+
+static bool heap_exists(heap_pxbuf *buf, uint16_t pos)
+{
+        for (uint16_t i = 0; i < buf->size; i++) {
+                if (buf->buf[i].pos == pos)
+                        return true;
+                else if (buf->buf[i].pos > pos)
+                        break;
+        }
+
+        return false;
+}
+
+static void heap_remove(heap_pxbuf *buf, uint16_t index)
+{
+        buf->size--;
+
+        if (buf->size == 0) {
+                free(buf->buf);
+                buf->buf = NULL;
+                return;
+        }
+
+        for (uint16_t i = index; i < buf->size; i++)
+                buf->buf[i] = buf->buf[i+1];
+
+        buf->buf = (pxl *)realloc(buf->buf, sizeof(pxl) * buf->size);
+}
+
+static bool heap_remove_at(heap_pxbuf *buf, uint16_t pos)
+{
+        for (uint16_t i = 0; i < buf->size; i++) {
+                if (buf->buf[i].pos == pos) {
+                        heap_remove(buf, i);
+                        return true;
+                }
+
+                if (buf->buf[i].pos > pos)
+                        return false;
+        }
+
+        return false;
+}
+
+/* heap_apply
+ * ----------
+ * Description:
+ *      Signs and sends a heap-backed pixel buffer like
+ *      strip_apply_pxbuf did before the pool.
+ */
+static void heap_apply(heap_pxbuf *buf)
+{
+        uint16_t i = 0;
+
+        frame_sig_begin();
+        for (uint16_t px_i = 0; px_i < buf->size; px_i++)
+                frame_sig_run(buf->buf[px_i].rgb, buf->buf[px_i].pos);
+        frame_sig_run(off, strip_size);
+        frame_sig_end();
+        if (!frame_sig_dirty())
+                return;
+
+        ws2812_prep_tx();
+        for (uint16_t px_i = 0; px_i < buf->size && buf->buf[px_i].pos < strip_size; px_i++) {
+                ws2812_tx_run(off, buf->buf[px_i].pos - i);
+                ws2812_tx_run(buf->buf[px_i].rgb, 1);
+                i = buf->buf[px_i].pos + 1;
+        }
+        ws2812_tx_run(off, strip_size - i);
+        ws2812_end_tx(0);
+}
+
+static uint64_t bench_us()
+{
+        struct timeval tv;
+
+        gettimeofday(&tv, NULL);
+        return (uint64_t) tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+/* shuffle
+ * -------
+ * Parameters:
+ *      pos - Positions to be shuffled
+ *      n - Number of positions
+ * Description:
+ *      Shuffles the positions of the strip, so drops are
+ *      inserted and removed in random order.
+ */
+static void shuffle(uint16_t *pos, uint16_t n)
+{
+        for (uint16_t i = n - 1; i > 0; i--) {
+                uint16_t j = rand() % (i + 1);
+                uint16_t t = pos[i];
+
+                pos[i] = pos[j];
+                pos[j] = t;
+        }
+}
+
+/* bench_t
+ * -------
+ * Description:
+ *      Time in us of each operation of a buffer,
+ *      over BENCH_ROUNDS buffers.
+ */
+typedef struct bench_t {
+        uint64_t insert;
+        uint64_t exists;
+        uint64_t apply;
+        uint64_t remove;
+} bench_t;
+
+static uint16_t pos[BENCH_ROUNDS][BENCH_STRIP_SIZE];
+static heap_pxbuf heap[BENCH_ROUNDS];
+static pxbuf pool[BENCH_ROUNDS];
+
+static void bench_heap(uint16_t n, bench_t *t)
+{
+        RGB_t rgb = {255, 255, 255};
+        uint32_t hits = 0;
+        uint64_t start;
+
+        start = bench_us();
+        for (uint16_t r = 0; r < BENCH_ROUNDS; r++) {
+                for (uint16_t i = 0; i < n; i++)
+                        heap_insert(&heap[r], pos[r][i], rgb);
+        }
+        t->insert = bench_us() - start;
+
+        start = bench_us();
+        for (uint16_t r = 0; r < BENCH_ROUNDS; r++) {
+                for (uint16_t i = 0; i < BENCH_STRIP_SIZE; i++)
+                        hits += heap_exists(&heap[r], i);
+        }
+        t->exists = bench_us() - start;
+        TEST_ASSERT_EQUAL(n * BENCH_ROUNDS, hits);
+
+        start = bench_us();
+        for (uint16_t r = 0; r < BENCH_ROUNDS; r++) {
+                // The frame may not be skipped as unchanged
+                tx_sig_valid = false;
+                heap_apply(&heap[r]);
+        }
+        t->apply = bench_us() - start;
+
+        start = bench_us();
+        for (uint16_t r = 0; r < BENCH_ROUNDS; r++) {
+                for (uint16_t i = n; i > 0; i--)
+                        heap_remove_at(&heap[r], pos[r][i - 1]);
+        }
+        t->remove = bench_us() - start;
+}
+
+static void bench_pool(uint16_t n, bench_t *t)
+{
+        RGB_t rgb = {255, 255, 255};
+        uint32_t hits = 0;
+        uint64_t start;
+
+        for (uint16_t r = 0; r < BENCH_ROUNDS; r++)
+                pxbuf_init(&pool[r]);
+
+        start = bench_us();
+        for (uint16_t r = 0; r < BENCH_ROUNDS; r++) {
+                for (uint16_t i = 0; i < n; i++)
+                        pxbuf_insert(&pool[r], pos[r][i], rgb);
+        }
+        t->insert = bench_us() - start;
+
+        start = bench_us();
+        for (uint16_t r = 0; r < BENCH_ROUNDS; r++) {
+                for (uint16_t i = 0; i < BENCH_STRIP_SIZE; i++)
+                        hits += pxbuf_exists(&pool[r], i);
+        }
+        t->exists = bench_us() - start;
+        TEST_ASSERT_EQUAL(n * BENCH_ROUNDS, hits);
+
+        start = bench_us();
+        for (uint16_t r = 0; r < BENCH_ROUNDS; r++) {
+                tx_sig_valid = false;
+                strip_apply_pxbuf(&pool[r]);
+        }
+        t->apply = bench_us() - start;
+
+        start = bench_us();
+        for (uint16_t r = 0; r < BENCH_ROUNDS; r++) {
+                for (uint16_t i = n; i > 0; i--)
+                        pxbuf_remove_at(&pool[r], pos[r][i - 1]);
+        }
+        t->remove = bench_us() - start;
+}
+
+/* test_pxbuf_bench
+ * ----------------
+ * Description:
+ *      Fills BENCH_ROUNDS buffers of each kind with 1 to
+ *      BENCH_STRIP_SIZE drops at random positions, looks up every
+ *      position, sends the frames and removes the drops again in
+ *      reverse order. Prints the mean time per operation in ns,
+ *      for the pool only up to PXBUF_SIZE drops.
+ */
+void test_pxbuf_bench()
+{
+        static const uint16_t drops[] = {1, 4, 16, 32, 64, 128, 256, 512, BENCH_STRIP_SIZE};
+
+        srand(1);
+        strip_size = BENCH_STRIP_SIZE;
+
+        printf("%6s | %-17s | %-17s | %-17s | %-17s\n", "", "insert", "exists", "apply", "remove");
+        printf("%6s | %8s %8s | %8s %8s | %8s %8s | %8s %8s\n", "drops",
+               "heap", "pool", "heap", "pool", "heap", "pool", "heap", "pool");
+
+        for (uint8_t d = 0; d < sizeof(drops) / sizeof(drops[0]); d++) {
+                uint16_t n = drops[d];
+                bench_t t[2] = {};
+                char pool_col[4][16];
+
+                for (uint16_t r = 0; r < BENCH_ROUNDS; r++) {
+                        for (uint16_t i = 0; i < BENCH_STRIP_SIZE; i++)
+                                pos[r][i] = i;
+                        shuffle(pos[r], BENCH_STRIP_SIZE);
+                }
+
+                bench_heap(n, &t[0]);
+
+                if (n > PXBUF_SIZE) {
+                        for (uint8_t i = 0; i < 4; i++)
+                                snprintf(pool_col[i], sizeof(pool_col[i]), "full");
+                } else {
+                        // Both must send the frame of the last round
+                        std::vector<uint32_t> frame = host_px;
+
+                        bench_pool(n, &t[1]);
+                        TEST_ASSERT_TRUE(frame == host_px);
+
+                        snprintf(pool_col[0], sizeof(pool_col[0]), "%.1f", 1000.0 * t[1].insert / (n * BENCH_ROUNDS));
+                        snprintf(pool_col[1], sizeof(pool_col[1]), "%.1f", 1000.0 * t[1].exists / (BENCH_STRIP_SIZE * BENCH_ROUNDS));
+                        snprintf(pool_col[2], sizeof(pool_col[2]), "%.0f", 1000.0 * t[1].apply / BENCH_ROUNDS);
+                        snprintf(pool_col[3], sizeof(pool_col[3]), "%.1f", 1000.0 * t[1].remove / (n * BENCH_ROUNDS));
+                }
+
+                printf("%6u | %8.1f %8s | %8.1f %8s | %8.0f %8s | %8.1f %8s\n", n,
+                       1000.0 * t[0].insert / (n * BENCH_ROUNDS), pool_col[0],
+                       1000.0 * t[0].exists / (BENCH_STRIP_SIZE * BENCH_ROUNDS), pool_col[1],
+                       1000.0 * t[0].apply / BENCH_ROUNDS, pool_col[2],
+                       1000.0 * t[0].remove / (n * BENCH_ROUNDS), pool_col[3]);
+        }
+}
+
+int main()
+{
+        UNITY_BEGIN();
+        RUN_TEST(test_pxbuf_bench);
+        return UNITY_END();
+}
@@ -0,0 +1,123 @@
+/*
+ * Host tests of the rotating rainbow (see rainbow_px in strip.cpp),
+ * run with `pio test -e native`. The rainbow steps its output colors
+ * by additions only, its pixels must equal the output stage of the
+ * hsv2rgb colors at every step size, brightness and dither offset.
+ */
+
+#include <stdio.h>
+#include <unity.h>
+
+#define RAINBOW_HUES
+#define TEMPORAL_DITHERING
+#define GAMMA_CORRECTION 2.8
+
+#include "color.cpp"
+#include "strip.cpp"
+#include "strip_host.h"
+
+void setUp() {}
+void tearDown() {}
+
+/* check_px
+ * --------
+ * Parameters:
+ *      p - Pixel of the rotating rainbow
+ *      step - Step size of the rainbow
+ * Description:
+ *      Compares a pixel of the rotating rainbow to the
+ *      output stage of its hsv2rgb color.
+ */
+static void check_px(const rainbow_pos *p, uint8_t step)
+{
+        RGB_t rgb, ref, px;
+
+        hsv2rgb(p->hue, 255, 255, rgb);
+        output_px(ref, rgb);
+        rainbow_px(p, px);
+
+        if (memcmp(ref, px, sizeof(RGB_t))) {
+                char msg[64];
+                snprintf(msg, sizeof(msg), "hue %u, step %u, brightness %u, dither %u",
+                         p->hue, step, out_brightness, out_dither);
+                TEST_FAIL_MESSAGE(msg);
+        }
+}
+
+/* test_rainbow_px
+ * ---------------
+ * Description:
+ *      Steps trough the wheel forwards and backwards at every
+ *      step size and compares every pixel to hsv2rgb.
+ */
+void test_rainbow_px()
+{
+        for (uint16_t b = 0; b < 256; b += 17) {
+                strip_set_brightness(b);
+
+                for (uint16_t d = 0; d < 256; d += 51) {
+                        out_dither = d;
+
+                        for (uint16_t step = 1; step < 256; step++) {
+                                out_acc_t inc = (out_acc_t) step * out_factor();
+                                rainbow_pos p;
+
+                                rainbow_seek(&p, (step * 7) % HUE_MAX);
+                                for (uint16_t i = 0; i < 2 * HUE_MAX / step; i++) {
+                                        check_px(&p, step);
+                                        rainbow_next(&p, step, inc, false);
+                                }
+
+                                for (uint16_t i = 0; i < 2 * HUE_MAX / step; i++) {
+                                        check_px(&p, step);
+                                        rainbow_next(&p, step, inc, true);
+                                }
+                        }
+                }
+        }
+}
+
+/* test_rotate_rainbow
+ * -------------------
+ * Description:
+ *      Sends the rotating rainbow trough the whole frame pipeline,
+ *      with and without the hue ring, and compares the pixels to
+ *      hsv2rgb.
+ */
+void test_rotate_rainbow()
+{
+        static const uint8_t steps[] = {1, 5, 8, 32, 100, 255};
+        input_frame in = {};
+        hue_t hue = 0;
+
+        in.dt = 1;
+        strip_size = 200;
+
+        for (uint8_t s = 0; s < sizeof(steps); s++) {
+                for (uint16_t b = 255; b > 0; b -= 85) {
+                        strip_set_brightness(b);
+                        strip_rotate_rainbow(&in, steps[s], 1);
+                        hue = hue_add(hue, steps[s]);
+
+                        TEST_ASSERT_EQUAL(200, host_px.size());
+
+                        hue_t h = hue;
+                        for (uint16_t i = 0; i < 200; i++) {
+                                RGB_t rgb, px;
+
+                                hsv2rgb(h, 255, 255, rgb);
+                                output_px(px, rgb);
+                                TEST_ASSERT_EQUAL((uint32_t) px[R] << 16 | (uint32_t) px[G] << 8 | px[B], host_px[i]);
+                                h = hue_add(h, steps[s]);
+                        }
+                }
+        }
+}
+
+int main()
+{
+        UNITY_BEGIN();
+        RUN_TEST(test_rainbow_px);
+        RUN_TEST(test_rotate_rainbow);
+        return UNITY_END();
+}
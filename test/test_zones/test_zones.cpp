@@ -0,0 +1,88 @@
+/*
+ * Host tests of zones running the same effect (see FX_STATE in
+ * strip.cpp), run with `pio test -e native`. Every zone must keep
+ * the state of its effect on its own, so two zones running the
+ * rotating rainbow advance exactly like a single one.
+ */
+
+#include <stdio.h>
+#include <unity.h>
+
+#define ZONES ZONE(0, 20, 0) ZONE(20, 20, 1)
+
+#include "color.cpp"
+#include "strip.cpp"
+#include "strip_host.h"
+
+void setUp() {}
+void tearDown() {}
+
+/* check_zone
+ * ----------
+ * Parameters:
+ *      start - First pixel of the zone
+ *      hue - Hue of the first pixel
+ *      step - Hue steps between each pixel
+ *      brightness - Brightness of the zone
+ * Description:
+ *      Compares the pixels of a zone to the output
+ *      stage of the hsv2rgb colors of the rainbow.
+ */
+static void check_zone(uint16_t start, hue_t hue, uint8_t step, uint8_t brightness)
+{
+        strip_set_brightness(brightness);
+
+        for (uint16_t i = 0; i < 20; i++) {
+                RGB_t rgb, px;
+
+                hsv2rgb(hue, 255, 255, rgb);
+                output_px(px, rgb);
+                TEST_ASSERT_EQUAL((uint32_t) px[R] << 16 | (uint32_t) px[G] << 8 | px[B], host_px[start + i]);
+                hue = hue_add(hue, step);
+        }
+}
+
+/* test_rotate_rainbow
+ * -------------------
+ * Description:
+ *      Runs the rotating rainbow in both zones, at different
+ *      brightnesses, with and without the hue ring.
+ */
+void test_rotate_rainbow()
+{
+        static const uint8_t steps[] = {8, 5};
+        input_frame in = {};
+        hue_t hue = 0;
+
+        in.dt = 1;
+        strip_size = 40;
+
+        for (uint8_t s = 0; s < sizeof(steps); s++) {
+                for (uint8_t f = 0; f < 10; f++) {
+                        strip_frame_begin();
+
+                        strip_zone_begin(0);
+                        strip_set_brightness(255);
+                        strip_rotate_rainbow(&in, steps[s], 1);
+
+                        strip_zone_begin(1);
+                        strip_set_brightness(100);
+                        strip_rotate_rainbow(&in, steps[s], 1);
+
+                        strip_frame_end();
+
+                        hue = hue_add(hue, steps[s]);
+
+                        TEST_ASSERT_EQUAL(40, host_px.size());
+                        check_zone(0, hue, steps[s], 255);
+                        check_zone(20, hue, steps[s], 100);
+                }
+        }
+}
+
+int main()
+{
+        UNITY_BEGIN();
+        RUN_TEST(test_rotate_rainbow);
+        return UNITY_END();
+}